@@ -0,0 +1,79 @@
+#!/usr/bin/env python
+#
+# Expands a blackbox log (written a page at a time by the firmware's Logger, see include/logger.h)
+# into CSV, one row per control loop, in the units the firmware works in.
+#
+#   python blackbox_decode.py blackbox.bin > blackbox.csv
+#
+__author__ = "ROSflight"
+__copyright__ = "Copyright 2017, ROSflight"
+__license__ = "BSD-3"
+
+import struct
+import sys
+
+PAGE_SIZE = 256
+PAGE_MAGIC = 0xB5
+FORMAT_VERSION = 1
+RECORD_KEY_FRAME = 1
+RECORD_DELTA = 2
+
+FIELDS = [('accel_x', 1e3), ('accel_y', 1e3), ('accel_z', 1e3),
+          ('gyro_x', 1e4), ('gyro_y', 1e4), ('gyro_z', 1e4),
+          ('q_w', 1e4), ('q_x', 1e4), ('q_y', 1e4), ('q_z', 1e4),
+          ('control_F', 1e4), ('control_x', 1e4), ('control_y', 1e4), ('control_z', 1e4)]
+
+
+def varint(page, i):
+    value = 0
+    shift = 0
+    while True:
+        byte = page[i]
+        i += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return value, i
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def wrap32(value):
+    return (value + 2**31) % 2**32 - 2**31
+
+
+def decode(data, out):
+    header = None
+    for start in range(0, len(data) - PAGE_SIZE + 1, PAGE_SIZE):
+        page = bytearray(data[start:start + PAGE_SIZE])
+        magic, version, sequence, outputs, dropped = struct.unpack('<BBHBH', bytes(page[:7]))
+        if magic != PAGE_MAGIC or version != FORMAT_VERSION:
+            continue
+        fields = FIELDS + [('output_%d' % n, 1e4) for n in range(outputs)]
+        if header is None:
+            header = ['page', 'time_us'] + [name for name, _ in fields]
+            out.write(','.join(header) + '\n')
+        if dropped:
+            sys.stderr.write('page %d: %d records dropped before it\n' % (sequence, dropped))
+
+        i = 7
+        time_us = 0
+        values = [0] * len(fields)
+        while i < PAGE_SIZE and page[i] in (RECORD_KEY_FRAME, RECORD_DELTA):
+            key_frame = page[i] == RECORD_KEY_FRAME
+            dt, i = varint(page, i + 1)
+            time_us = dt if key_frame else time_us + dt
+            for n in range(len(fields)):
+                value, i = varint(page, i)
+                values[n] = unzigzag(value) if key_frame else wrap32(values[n] + unzigzag(value))
+            out.write(','.join([str(sequence), str(time_us)] +
+                               ['%g' % (v / scale) for v, (_, scale) in zip(values, fields)]) + '\n')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.stderr.write('usage: %s <log file>\n' % sys.argv[0])
+        sys.exit(1)
+    decode(open(sys.argv[1], 'rb').read(), sys.stdout)
@@ -36,51 +36,54 @@
 
 void initEEPROM(void)
 {
-  // make sure (at compile time) that config struct doesn't overflow allocated flash pages
-  // ct_assert(sizeof(_params) < CONFIG_SIZE);
+  // Nothing to set up, the config pages are read straight from the memory map
 }
 
-static uint8_t compute_checksum(const void * addr, size_t len)
+bool readEEPROM(size_t offset, void * dest, size_t len)
 {
-  const uint8_t *p;
-  uint8_t chk = 0;
-
-  for (p = (const uint8_t *)addr; p < ((const uint8_t *)addr + len); p++)
-    chk ^= *p;
+  if (offset + len > CONFIG_SIZE)
+    return false;
 
-  return chk;
+  memcpy(dest, (char *)FLASH_WRITE_ADDR + offset, len);
+  return true;
 }
 
-bool readEEPROM(void * dest, size_t len)
+bool programEEPROM(size_t offset, const void * src, size_t len)
 {
-  memcpy(dest, (char *)FLASH_WRITE_ADDR, len);
-  return true;
+  FLASH_Status status = FLASH_COMPLETE;
+
+  if (offset + len > CONFIG_SIZE || (offset & 3) || (len & 3))
+    return false;
+
+  FLASH_Unlock();
+  FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_PGERR | FLASH_FLAG_WRPRTERR);
+  for (size_t i = 0; i < len && status == FLASH_COMPLETE; i += 4)
+  {
+    uint32_t word;
+    memcpy(&word, (const char *)src + i, 4);
+    status = FLASH_ProgramWord(FLASH_WRITE_ADDR + offset + i, word);
+  }
+  FLASH_Lock();
+
+  return status == FLASH_COMPLETE && memcmp(src, (char *)FLASH_WRITE_ADDR + offset, len) == 0;
 }
 
-bool writeEEPROM(const void * src, size_t len)
+bool eraseEEPROMPage(uint8_t page)
 {
-  FLASH_Status status;
+  FLASH_Status status = FLASH_COMPLETE;
+
+  if (page >= NUM_PAGES)
+    return false;
 
-  // write it
   FLASH_Unlock();
   for (unsigned int tries = 3; tries; tries--)
   {
     FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_PGERR | FLASH_FLAG_WRPRTERR);
-
-    for(int i = 0; i < NUM_PAGES; i++)
-      status = FLASH_ErasePage(FLASH_WRITE_ADDR + i * FLASH_PAGE_SIZE);
-
-    for (unsigned int i = 0; i < len && status == FLASH_COMPLETE; i += 4)
-      status = FLASH_ProgramWord(FLASH_WRITE_ADDR + i, *(uint32_t *)((char *)src + i));
-
-    if(status == FLASH_COMPLETE)
+    status = FLASH_ErasePage(FLASH_WRITE_ADDR + page * FLASH_PAGE_SIZE);
+    if (status == FLASH_COMPLETE)
       break;
   }
   FLASH_Lock();
 
-  // Flash write failed - just die now
-  if (status != FLASH_COMPLETE || compute_checksum(src, len) != compute_checksum((uint32_t*)FLASH_WRITE_ADDR, len))
-    return false;
-
-  return true;
+  return status == FLASH_COMPLETE;
 }
@@ -46,7 +46,7 @@
 #endif
 
 #define FLASH_PAGE_SIZE                 ((uint16_t)0x400)
-#define NUM_PAGES                       3
+#define NUM_PAGES                       4
 // if sizeof(_params) is over this number, compile-time error will occur. so, need to add another page to config data.
 // TODO compile time check is currently disabled
 #define CONFIG_SIZE                     (FLASH_PAGE_SIZE * NUM_PAGES)
@@ -64,16 +64,25 @@ void initEEPROM(void);
 
 /**
  * @brief Read data from Flash
+ * @param offset Where to start reading, from the start of the config pages
  * @param dest The memory address to copy the data to
  * @param len The number of bytes to copy
  * @returns true if the read was successful, false otherwise
  */
-bool readEEPROM(void * dest, size_t len);
+bool readEEPROM(size_t offset, void * dest, size_t len);
 
 /**
- * @brief Write data to Flash
+ * @brief Program data into erased Flash, a word at a time
+ * @param offset Where to start writing, from the start of the config pages (a multiple of 4)
  * @param src The memory address to copy data from
- * @param len The number of bytes to copy
- * @returns true if the write was successful, false otherwise
+ * @param len The number of bytes to copy (a multiple of 4)
+ * @returns true if the data reads back correctly, false otherwise
+ */
+bool programEEPROM(size_t offset, const void * src, size_t len);
+
+/**
+ * @brief Erase one of the config pages
+ * @param page The page, from 0 to NUM_PAGES - 1
+ * @returns true if the erase was successful, false otherwise
  */
-bool writeEEPROM(const void * src, size_t len);
+bool eraseEEPROMPage(uint8_t page);
@@ -93,6 +93,33 @@ void Naze32::serial_write(const uint8_t *src, size_t len)
   }
 }
 
+// Room left in the UART driver's transmit buffer.  The driver's DMA-complete interrupt starts the
+// next transfer on its own, but it moves the tail past a block as soon as the transfer starts, so
+// the bytes the DMA hasn't sent yet are still in use.  The tail is read before the DMA count so an
+// interrupt in between can only make this come out short.
+static uint32_t serial_tx_space(const serialPort_t *serial)
+{
+  const uartPort_t *uart = reinterpret_cast<const uartPort_t *>(serial);
+  uint32_t tail = serial->txBufferTail;
+  uint32_t queued = (serial->txBufferHead + serial->txBufferSize - tail) % serial->txBufferSize;
+  if (uart->txDMAChannel && (uart->txDMAChannel->CCR & DMA_CCR1_EN))
+    queued += uart->txDMAChannel->CNDTR;
+  return (queued + 1 < serial->txBufferSize) ? serial->txBufferSize - queued - 1 : 0;
+}
+
+size_t Naze32::serial_write_nonblocking(const uint8_t *src, size_t len)
+{
+  // The driver overwrites its transmit buffer when full, so only hand it what fits
+  uint32_t space = serial_tx_space(Serial1);
+  if (len > space)
+    len = space;
+  for (size_t i = 0; i < len; i++)
+  {
+    serialWrite(Serial1, src[i]);
+  }
+  return len;
+}
+
 uint16_t Naze32::serial_bytes_available(void)
 {
   return serialTotalBytesWaiting(Serial1);
@@ -103,6 +130,14 @@ uint8_t Naze32::serial_read(void)
   return serialRead(Serial1);
 }
 
+size_t Naze32::serial_read(uint8_t *dst, size_t len)
+{
+  size_t count = 0;
+  while (count < len && serialTotalBytesWaiting(Serial1))
+    dst[count++] = serialRead(Serial1);
+  return count;
+}
+
 // sensors
 
 void Naze32::sensors_init()
@@ -118,6 +153,11 @@ void Naze32::sensors_init()
   mb1242_init();
   ms4525_init();
 
+  // Battery voltage
+  drv_adc_config_t adc_config;
+  adc_config.powerAdcChannel = 0;
+  adcInit(&adc_config);
+
   // IMU
   uint16_t acc1G;
   mpu6050_init(true, &acc1G, &_gyro_scale, _board_revision);
@@ -238,6 +278,12 @@ float Naze32::sonar_read(void)
     return 0.0f;
 }
 
+float Naze32::battery_read(void)
+{
+  // VBAT comes in through a 10k/1k divider on the 12-bit ADC
+  return adcGetChannel(ADC_BATTERY) * (3.3f * 11.0f / 4095.0f);
+}
+
 uint16_t num_sensor_errors(void)
 {
   return i2cGetErrorCounter();
@@ -260,6 +306,39 @@ void Naze32::pwm_write(uint8_t channel, uint16_t value)
   pwmWriteMotor(channel, value);
 }
 
+void Naze32::pwm_write_all(const uint16_t *values, uint8_t num_channels)
+{
+  // Write the compare registers back to back without being interrupted, so all outputs pick
+  // up their new values on the same timer period
+  __disable_irq();
+  for (uint8_t i = 0; i < num_channels; i++)
+    pwmWriteMotor(i, values[i]);
+  __enable_irq();
+}
+
+// DShot
+// BreezySTM32 has no DMA timer driver, so the naze always falls back to PWM
+
+uint16_t Naze32::dshot_init(uint32_t bitrate, bool bidirectional)
+{
+  (void) bitrate;
+  (void) bidirectional;
+  return 0;
+}
+
+void Naze32::dshot_write(const uint16_t *buffers, uint8_t num_channels)
+{
+  (void) buffers;
+  (void) num_channels;
+}
+
+bool Naze32::dshot_telemetry_read(uint8_t channel, uint32_t *raw)
+{
+  (void) channel;
+  (void) raw;
+  return false;
+}
+
 bool Naze32::pwm_lost()
 {
   return ((millis() - pwmLastUpdate()) > 40);
@@ -272,14 +351,44 @@ void Naze32::memory_init(void)
   initEEPROM();
 }
 
-bool Naze32::memory_read(void * dest, size_t len)
+size_t Naze32::memory_sector_size(void)
+{
+  return FLASH_PAGE_SIZE;
+}
+
+uint8_t Naze32::memory_sector_count(void)
+{
+  return NUM_PAGES;
+}
+
+bool Naze32::memory_read(size_t offset, void * dest, size_t len)
+{
+  return readEEPROM(offset, dest, len);
+}
+
+bool Naze32::memory_program(size_t offset, const void * src, size_t len)
+{
+  return programEEPROM(offset, src, len);
+}
+
+bool Naze32::memory_erase(uint8_t sector)
+{
+  return eraseEEPROMPage(sector);
+}
+
+// blackbox log
+// BreezySTM32 has no driver for the SPI flash on the rev5 boards, so the naze doesn't keep a log
+
+bool Naze32::log_init(void)
 {
-  return readEEPROM(dest, len);
+  return false;
 }
 
-bool Naze32::memory_write(const void * src, size_t len)
+bool Naze32::log_write(const uint8_t *page, size_t len)
 {
-  return writeEEPROM(src, len);
+  (void) page;
+  (void) len;
+  return false;
 }
 
 // LED
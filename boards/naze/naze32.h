@@ -83,8 +83,10 @@ public:
   // serial
   void serial_init(uint32_t baud_rate);
   void serial_write(const uint8_t *src, size_t len);
+  size_t serial_write_nonblocking(const uint8_t *src, size_t len);
   uint16_t serial_bytes_available(void);
   uint8_t serial_read(void);
+  size_t serial_read(uint8_t *dst, size_t len);
 
   // sensors
   void sensors_init();
@@ -106,17 +108,31 @@ public:
   bool sonar_check(void);
   float sonar_read(void);
 
+  float battery_read(void);
+
   // PWM
   // TODO make these deal in normalized (-1 to 1 or 0 to 1) values (not pwm-specific)
   void pwm_init(bool cppm, uint32_t refresh_rate, uint16_t idle_pwm);
   bool pwm_lost();
   uint16_t pwm_read(uint8_t channel);
   void pwm_write(uint8_t channel, uint16_t value);
+  void pwm_write_all(const uint16_t *values, uint8_t num_channels);
+
+  uint16_t dshot_init(uint32_t bitrate, bool bidirectional);
+  void dshot_write(const uint16_t *buffers, uint8_t num_channels);
+  bool dshot_telemetry_read(uint8_t channel, uint32_t *raw);
 
   // non-volatile memory
   void memory_init(void);
-  bool memory_read(void * dest, size_t len);
-  bool memory_write(const void * src, size_t len);
+  size_t memory_sector_size(void);
+  uint8_t memory_sector_count(void);
+  bool memory_read(size_t offset, void * dest, size_t len);
+  bool memory_program(size_t offset, const void * src, size_t len);
+  bool memory_erase(uint8_t sector);
+
+  // blackbox log
+  bool log_init(void);
+  bool log_write(const uint8_t *page, size_t len);
 
   // LEDs
   void led0_on(void);
@@ -56,8 +56,10 @@ public:
 // serial
   virtual void serial_init(uint32_t baud_rate) = 0;
   virtual void serial_write(const uint8_t *src, size_t len) = 0;
+  virtual size_t serial_write_nonblocking(const uint8_t *src, size_t len) = 0; // returns the number of bytes accepted
   virtual uint16_t serial_bytes_available(void) = 0;
   virtual uint8_t serial_read(void) = 0;
+  virtual size_t serial_read(uint8_t *dst, size_t len) = 0; // returns the number of bytes read, without waiting
 
 // sensors
   virtual void sensors_init() = 0;
@@ -79,17 +81,41 @@ public:
   virtual bool sonar_check(void) = 0;
   virtual float sonar_read(void) = 0;
 
+  // battery voltage in volts, 0 if the board has no battery monitor
+  virtual float battery_read(void) = 0;
+
 // PWM
 // TODO make these deal in normalized (-1 to 1 or 0 to 1) values (not pwm-specific)
   virtual void pwm_init(bool cppm, uint32_t refresh_rate, uint16_t idle_pwm) = 0;
   virtual bool pwm_lost() = 0;
   virtual uint16_t pwm_read(uint8_t channel) = 0;
   virtual void pwm_write(uint8_t channel, uint16_t value) = 0;
+  virtual void pwm_write_all(const uint16_t *values, uint8_t num_channels) = 0;
+
+// DShot
+  // returns the number of timer ticks per bit, or 0 if the board can't do DShot at this bitrate
+  virtual uint16_t dshot_init(uint32_t bitrate, bool bidirectional) = 0;
+  // buffers holds num_channels consecutive DShot::BUFFER_LENGTH timer compare values, and has to
+  // stay valid until the next call since it is clocked out with DMA
+  virtual void dshot_write(const uint16_t *buffers, uint8_t num_channels) = 0;
+  // raw 21-bit telemetry word captured after the last frame on that channel, if there is one
+  virtual bool dshot_telemetry_read(uint8_t channel, uint32_t *raw) = 0;
 
 // non-volatile memory
+  // Flash-like: erasing a sector sets it to 0xFF, and programming only clears bits.  Offsets and
+  // lengths passed to memory_program() are multiples of 4.
   virtual void memory_init(void) = 0;
-  virtual bool memory_read(void *dest, size_t len) = 0;
-  virtual bool memory_write(const void *src, size_t len) = 0;
+  virtual size_t memory_sector_size(void) = 0;
+  virtual uint8_t memory_sector_count(void) = 0;
+  virtual bool memory_read(size_t offset, void *dest, size_t len) = 0;
+  virtual bool memory_program(size_t offset, const void *src, size_t len) = 0; // false if it didn't verify
+  virtual bool memory_erase(uint8_t sector) = 0;
+
+// blackbox log
+  // returns false if the board has nowhere to keep a log
+  virtual bool log_init(void) = 0;
+  // appends one Logger::PAGE_SIZE page to the log, returns false once the log is full
+  virtual bool log_write(const uint8_t *page, size_t len) = 0;
 
 // LEDs
   virtual void led0_on(void) = 0;
@@ -39,6 +39,7 @@
 
 #include "command_manager.h"
 #include "estimator.h"
+#include "mixer.h"
 
 namespace rosflight_firmware
 {
@@ -64,8 +65,60 @@ public:
   void run();
 
   void calculate_equilbrium_torque_from_rc();
+  bool start_autotune();
+  inline bool autotune_active() const { return autotune_axis_ != AUTOTUNE_NONE; }
   void param_change_callback(uint16_t param_id);
 
+  /**
+   * @brief World down axis in the body frame for a roll and pitch
+   */
+  static turbomath::Vector down_vector(float roll, float pitch);
+
+  /**
+   * @brief Attitude error used by the angle loops in quaternion mode
+   * @param attitude The estimated attitude
+   * @param down_command The commanded world down axis in the body frame, from down_vector()
+   * @returns The body-frame rotation vector from the estimated to the commanded tilt (the z
+   * component is not used)
+   */
+  static turbomath::Vector tilt_error(const turbomath::Quaternion& attitude, const turbomath::Vector& down_command);
+
+  // Relay feedback (Astrom-Hagglund) experiment on a single rate loop.  Drives the loop into a
+  // limit cycle with a bang-bang torque and measures its amplitude and period, using only a
+  // handful of running sums so memory and per-sample cost are constant.
+  class RelayAutotune
+  {
+  public:
+    enum Status
+    {
+      RUNNING,
+      DONE,
+      FAILED
+    };
+
+    void start(float relay, float hysteresis, uint64_t now_us);
+    float run(uint64_t now_us, float error);
+    inline Status status() const { return status_; }
+    float ultimate_gain() const;
+    float ultimate_period() const;
+
+  private:
+    static constexpr uint8_t SETTLE_CYCLES = 2;
+    static constexpr uint8_t MEASURE_CYCLES = 4;
+    static constexpr uint32_t TIMEOUT_US = 2000000;
+
+    Status status_;
+    float relay_;
+    float hysteresis_;
+    float output_;
+    float max_;
+    float min_;
+    float amplitude_sum_;
+    uint64_t period_sum_us_;
+    uint64_t last_switch_us_;
+    uint8_t cycles_;
+  };
+
 private:
   class PID
   {
@@ -74,12 +127,18 @@ private:
     void init(float kp, float ki, float kd, float max, float min, float tau);
     float run(float dt, float x, float x_c, bool update_integrator);
     float run(float dt, float x, float x_c, bool update_integrator, float xdot);
+    void set_gain_scale(float scale);
 
   private:
     float kp_;
     float ki_;
     float kd_;
 
+    // gains as set by init(), before any gain scheduling
+    float kp_nominal_;
+    float ki_nominal_;
+    float kd_nominal_;
+
     float max_;
     float min_;
 
@@ -89,9 +148,38 @@ private:
     float tau_;
   };
 
+  enum
+  {
+    AUTOTUNE_ROLL,
+    AUTOTUNE_PITCH,
+    AUTOTUNE_YAW,
+    AUTOTUNE_NONE
+  };
+
+  enum
+  {
+    GAIN_SCHEDULE_ROLL,
+    GAIN_SCHEDULE_ROLL_RATE,
+    GAIN_SCHEDULE_PITCH,
+    GAIN_SCHEDULE_PITCH_RATE,
+    GAIN_SCHEDULE_YAW_RATE,
+    GAIN_SCHEDULE_COUNT
+  };
+  static constexpr uint8_t GAIN_SCHEDULE_POINTS = 3;
+
   ROSflight& RF_;
 
+  void init_gain_schedule();
+  void run_gain_schedule();
   turbomath::Vector run_pid_loops(uint32_t dt, const Estimator::State& state, const control_t& command, bool update_integrators);
+  turbomath::Vector attitude_error(const Estimator::State& state, const control_t& command);
+  void init_indi();
+  inline float indi_saturate(float u) const { return (u > indi_max_) ? indi_max_ : (u < -indi_max_) ? -indi_max_ : u; }
+  void init_indi_effectiveness(const Mixer::mixer_t* mixer);
+  void run_indi(uint32_t dt_us, const control_t& command, turbomath::Vector& torque, turbomath::Vector& feedforward);
+  void run_autotune(turbomath::Vector& pid_output);
+  void finish_autotune_axis();
+  void stop_autotune(const char* reason);
 
   Output output_;
 
@@ -101,6 +189,31 @@ private:
   PID pitch_rate_;
   PID yaw_rate_;
 
+  // Commanded roll and pitch as the world down axis in the body frame (only rebuilt when the angle
+  // command changes)
+  turbomath::Vector down_command_;
+  float roll_command_;
+  float pitch_command_;
+
+  bool gain_schedule_enabled_;
+  float gain_schedule_breakpoints_[GAIN_SCHEDULE_POINTS];
+  float gain_schedule_[GAIN_SCHEDULE_COUNT][GAIN_SCHEDULE_POINTS];
+
+  // Incremental nonlinear dynamic inversion
+  bool indi_enabled_;
+  float indi_alpha_;
+  float indi_max_;
+  turbomath::Vector indi_inv_effectiveness_; // 1/G, unit torque command per rad/s^2
+  const Mixer::mixer_t* indi_mixer_;         // mixer the projection below was built for
+  bool indi_projection_valid_;
+  float indi_projection_[3][4];              // torque rows of inv(M'M), M = [F x y z] of the mixer
+  turbomath::Vector indi_prev_omega_;
+  turbomath::Vector indi_omega_dot_;         // filtered angular acceleration
+  turbomath::Vector indi_torque_;            // filtered torque of the previous mixer outputs
+
+  RelayAutotune autotune_;
+  uint8_t autotune_axis_;
+
   uint64_t prev_time_us_;
 };
 
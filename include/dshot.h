@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef ROSFLIGHT_FIRMWARE_DSHOT_H
+#define ROSFLIGHT_FIRMWARE_DSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+namespace rosflight_firmware
+{
+
+/**
+ * @brief Board-agnostic DShot frame encoding and bidirectional telemetry decoding
+ *
+ * A frame is 11 bits of throttle (or command), a telemetry request bit and a 4-bit CRC, sent MSB
+ * first.  Each bit is encoded as the high time of one timer period, so a board only has to clock
+ * the buffer out of a timer compare register with DMA.
+ */
+class DShot
+{
+public:
+  enum Protocol
+  {
+    PROTOCOL_PWM,
+    PROTOCOL_DSHOT150,
+    PROTOCOL_DSHOT300,
+    PROTOCOL_DSHOT600,
+    PROTOCOL_COUNT
+  };
+
+  static constexpr uint8_t FRAME_BITS = 16;
+  static constexpr uint8_t BUFFER_LENGTH = FRAME_BITS + 2; // two low periods end the frame
+  static constexpr uint16_t MIN_THROTTLE = 48; // 0-47 are reserved for commands, 0 is motor stop
+  static constexpr uint16_t MAX_THROTTLE = 2047;
+
+  static uint32_t bitrate(Protocol protocol);
+
+  /**
+   * @brief Build a 16-bit frame
+   * @param value Throttle (48-2047) or command (0-47)
+   * @param telemetry Request telemetry over the separate telemetry wire
+   * @param bidirectional Inverts the CRC, as expected by ESCs answering with eRPM on the signal wire
+   */
+  static uint16_t frame(uint16_t value, bool telemetry, bool bidirectional);
+
+  /**
+   * @brief Expand a frame into BUFFER_LENGTH timer compare values
+   * @param bit_ticks Timer ticks per bit, as returned by Board::dshot_init()
+   */
+  static void encode(uint16_t frame, uint16_t bit_ticks, uint16_t *buffer);
+
+  /**
+   * @brief Decode a bidirectional DShot telemetry word
+   * @param raw The 21 bits sampled from the signal wire, start bit included
+   * @param erpm Electrical RPM (0 if the motor is stopped)
+   * @return false if the word is not valid GCR or the checksum fails
+   */
+  static bool decode_telemetry(uint32_t raw, uint32_t *erpm);
+};
+
+} // namespace rosflight_firmware
+
+#endif // ROSFLIGHT_FIRMWARE_DSHOT_H
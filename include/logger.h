@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef ROSFLIGHT_FIRMWARE_LOGGER_H
+#define ROSFLIGHT_FIRMWARE_LOGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mixer.h"
+#include "ring_buffer.h"
+
+// Pages of RAM the log is buffered in (a power of two), boards with nowhere to put a log can
+// set this to 0 to compile it out
+#ifndef ROSFLIGHT_LOG_BUFFER_PAGES
+#define ROSFLIGHT_LOG_BUFFER_PAGES 8
+#endif
+
+namespace rosflight_firmware
+{
+
+class ROSflight;
+
+/**
+ * @brief Onboard blackbox log of every control loop
+ *
+ * Each loop's IMU sample, attitude, controller output and mixer outputs are scaled to integers and
+ * stored as the difference from the previous loop, zigzag encoded into variable-length integers, so
+ * a steady loop costs a byte or two per field.  Records are built in a RAM buffer of PAGE_SIZE
+ * pages, which run() hands to Board::log_write() one at a time outside of the control loop.
+ *
+ * Every page starts with a header and a key frame of absolute values, and records never span
+ * pages, so each page can be decoded on its own (see blackbox_decode.py):
+ *
+ *   page:    0xB5, FORMAT_VERSION, sequence (u16), output count, records dropped (u16), records,
+ *            zero padding
+ *   record:  RECORD_KEY_FRAME or RECORD_DELTA, time (us, or the change in it, unsigned varint),
+ *            then each field (zigzag varint) in the order of the field_t enum and the outputs
+ */
+class Logger
+{
+public:
+  enum
+  {
+    LOG_OFF,
+    LOG_ARMED,
+    LOG_ALWAYS
+  };
+
+  static constexpr uint16_t PAGE_SIZE = 256;
+  static constexpr uint8_t PAGE_MAGIC = 0xB5;
+  static constexpr uint8_t FORMAT_VERSION = 1;
+  static constexpr uint8_t PAGE_HEADER_LEN = 7;
+  static constexpr uint8_t BUFFER_PAGES = ROSFLIGHT_LOG_BUFFER_PAGES;
+
+  enum : uint8_t
+  {
+    RECORD_END, // the rest of the page is padding
+    RECORD_KEY_FRAME,
+    RECORD_DELTA
+  };
+
+  enum field_t
+  {
+    FIELD_ACCEL_X, // mm/s^2
+    FIELD_ACCEL_Y,
+    FIELD_ACCEL_Z,
+    FIELD_GYRO_X, // 0.1 mrad/s
+    FIELD_GYRO_Y,
+    FIELD_GYRO_Z,
+    FIELD_ATTITUDE_W, // 1e-4
+    FIELD_ATTITUDE_X,
+    FIELD_ATTITUDE_Y,
+    FIELD_ATTITUDE_Z,
+    FIELD_CONTROL_F, // 1e-4
+    FIELD_CONTROL_X,
+    FIELD_CONTROL_Y,
+    FIELD_CONTROL_Z,
+    FIELD_OUTPUTS, // 1e-4, one per mixer output
+    FIELD_COUNT = FIELD_OUTPUTS + Mixer::NUM_OUTPUTS
+  };
+
+  Logger(ROSflight& rf);
+
+  void init();
+  void record();
+  void run();
+
+  inline uint32_t pages_written() const { return pages_written_; }
+  inline uint32_t records_dropped() const { return records_dropped_; }
+
+private:
+  // The longest record is the type byte, a 64-bit time and every field at 5 bytes
+  static constexpr uint16_t MAX_RECORD_LEN = 1 + 10 + 5*FIELD_COUNT;
+  static_assert(PAGE_HEADER_LEN + MAX_RECORD_LEN <= PAGE_SIZE, "a key frame has to fit in a page");
+
+  ROSflight& RF_;
+  bool available_; // the board has somewhere to put the log
+
+  // Only whole pages go into the buffer and it holds a whole number of them, so a page is never
+  // split across its end
+  RingBuffer<BUFFER_PAGES*PAGE_SIZE> buffer_;
+  uint16_t page_used_; // bytes of the page being filled, 0 before its header is written
+  uint16_t page_sequence_;
+
+  uint64_t last_time_us_;
+  int32_t last_fields_[FIELD_COUNT];
+  uint32_t pages_written_;
+  uint32_t records_dropped_;
+  uint16_t dropped_since_page_;
+
+  void write_padding(uint16_t length);
+  uint16_t encode(uint8_t *dst, uint64_t time_us, const int32_t *fields, bool key_frame) const;
+  static uint8_t put_varint(uint8_t *dst, uint64_t value);
+  static inline uint32_t zigzag(int32_t value)
+  {
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+  }
+  static inline int32_t scale(float value, float scale);
+};
+
+} // namespace rosflight_firmware
+
+#endif // ROSFLIGHT_FIRMWARE_LOGGER_H
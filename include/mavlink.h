@@ -37,10 +37,37 @@
 #pragma GCC diagnostic ignored "-Wswitch-default"
 #pragma GCC diagnostic ignored "-Wcast-align"
 
+// The library's send functions serialize each message straight into the transmit buffer through
+// these hooks, instead of packing it into a mavlink_message_t and copying it out again
+#include <mavlink/v1.0/mavlink_types.h>
+extern mavlink_system_t mavlink_system;
+
+namespace rosflight_firmware {
+void mavlink_tx_start(uint16_t length);
+void mavlink_tx_bytes(const uint8_t *data, uint16_t length);
+void mavlink_tx_end(void);
+}
+
+#define MAVLINK_USE_CONVENIENCE_FUNCTIONS
+#define MAVLINK_START_UART_SEND(chan, length) rosflight_firmware::mavlink_tx_start(length)
+#define MAVLINK_SEND_UART_BYTES(chan, data, length) rosflight_firmware::mavlink_tx_bytes(data, length)
+#define MAVLINK_END_UART_SEND(chan, length) rosflight_firmware::mavlink_tx_end()
+
 #include <mavlink/v1.0/rosflight/mavlink.h>
+#include "mavlink_imu_batch.h"
+#include "mavlink_log.h"
+#include "mavlink_param_bulk.h"
+
+// Commands handled by the firmware that are not yet part of the generated ROSflight dialect.  They
+// are numbered down from the top of the command field, well clear of the values the dialect's
+// ROSFLIGHT_CMD enum takes as it grows; remove them once the dialect defines them.
+#ifndef ROSFLIGHT_CMD_AUTOTUNE
+#define ROSFLIGHT_CMD_AUTOTUNE 250
+#endif
 
 # pragma GCC diagnostic pop
 #include "nanoprintf.h"
+#include "ring_buffer.h"
 
 namespace rosflight_firmware {
 
@@ -65,6 +92,7 @@ private:
     STREAM_ID_SERVO_OUTPUT_RAW,
     STREAM_ID_RC_RAW,
     STREAM_ID_LOW_PRIORITY,
+    STREAM_ID_TIMESYNC,
     STREAM_COUNT
   };
 
@@ -77,6 +105,104 @@ private:
   mavlink_status_t status_;
   bool initialized_;
 
+  // Outgoing bytes wait here until the board can take them, whole messages are dropped (and
+  // counted) when it is full so the control loop never waits on the serial port
+  static constexpr uint16_t TX_BUFFER_SIZE = 512;
+  RingBuffer<TX_BUFFER_SIZE> tx_buffer_;
+  uint32_t tx_dropped_messages_;
+  uint32_t tx_dropped_reported_;
+  bool tx_dropping_; // the message being serialized didn't fit
+
+  // The library only frames MAVLink 1, so MAVLink 2 frames are built and parsed here.  Outgoing
+  // messages are reframed as they are serialized, with the trailing zeros of the payload left off.
+  static constexpr uint8_t MAVLINK2_STX = 0xFD;
+  static constexpr uint8_t MAVLINK2_HEADER_LEN = 10; // including the start byte
+  static constexpr uint8_t MAVLINK2_SIGNATURE_LEN = 13;
+  static constexpr uint8_t MAVLINK2_IFLAG_SIGNED = 0x01;
+  bool mavlink2_;
+  uint8_t tx_header_[MAVLINK_NUM_HEADER_BYTES]; // MAVLink 1 header of the message being sent
+  uint16_t tx_offset_;
+  uint8_t rx2_header_[MAVLINK2_HEADER_LEN];
+  uint16_t rx2_index_;
+  uint16_t rx2_crc_;
+  mavlink_message_t rx2_msg_;
+
+  // The bulk parameter blob is the table hash, the parameter count and a flags byte, then every
+  // value, then every name and type if the client's cached copy of the table is out of date
+  static constexpr uint8_t PARAM_BLOB_HEADER_LEN = 7;
+  static constexpr uint8_t PARAM_BLOB_FLAG_NAMES = 0x01;
+  uint16_t param_blob_offset_;
+  uint16_t param_blob_length_; // 0 when no transfer is running
+  bool param_blob_names_;
+
+  // Log calls only queue the format string and the raw arguments.  The message is formatted (or,
+  // with LOG_BINARY, sent as the format string's id for the onboard computer to look up) later,
+  // in the low-priority stream.
+  static constexpr uint8_t LOG_QUEUE_LENGTH = 16;
+  static constexpr uint8_t LOG_MAX_ARGS = 4;
+  typedef union
+  {
+    uint32_t value;
+    const char *string;
+  } log_arg_t;
+  typedef struct
+  {
+    const char *fmt;
+    log_arg_t args[LOG_MAX_ARGS];
+    uint8_t severity;
+    bool has_strings; // has to be sent as text
+  } log_entry_t;
+  log_entry_t log_queue_[LOG_QUEUE_LENGTH];
+  uint8_t log_head_;
+  uint8_t log_tail_;
+  uint32_t log_dropped_;
+
+  // The onboard computer's clock is estimated from the answers to our own TIMESYNC requests, each
+  // of which gives its time at the middle of the round trip.  Offset and skew are tracked with an
+  // alpha-beta filter, leaving out answers whose round trip took much longer than usual.
+  static constexpr uint8_t TIMESYNC_MIN_SAMPLES = 5; // before the estimate is used
+  static constexpr uint32_t TIMESYNC_RTT_MARGIN_US = 1000;
+  static constexpr int64_t TIMESYNC_RESET_NS = 100000000; // the host clock was set, start over
+  static constexpr float TIMESYNC_ALPHA = 0.2f;
+  static constexpr float TIMESYNC_BETA = 0.02f;
+  static constexpr float TIMESYNC_MAX_SKEW = 500e-6f;
+  bool timesync_pending_;
+  uint64_t timesync_request_us_;
+  uint64_t timesync_ref_us_;  // when the offset was last updated
+  int64_t host_offset_ns_;    // host time minus our time at timesync_ref_us_
+  float host_skew_;           // how much faster the host clock runs than ours
+  uint32_t timesync_rtt_us_;
+  uint8_t timesync_samples_;
+
+  // Each receive() call parses at most this much, so a burst of incoming messages can't hold up
+  // the control loop; what is left waits in the board's buffer for the next call
+  static constexpr uint16_t RX_CHUNK_BYTES = 32;
+  static constexpr uint16_t RX_BUDGET_BYTES = 256;
+  static constexpr uint32_t RX_BUDGET_US = 200;
+  uint32_t rx_budget_overruns_;
+  uint32_t rx_budget_overruns_reported_;
+
+  // Streams are scheduled within the link's byte budget, using deficit round robin to share it
+  // between them by priority when they ask for more than the link can carry
+  static constexpr uint16_t STREAM_QUANTUM_BYTES = 16;
+  static constexpr float LINK_USABLE_FRACTION = 0.9f; // leave room for unscheduled messages
+  float link_bytes_per_us_;
+  float tx_budget_bytes_;
+  uint64_t last_stream_time_us_;
+  uint64_t rate_window_start_us_;
+  uint8_t next_stream_;
+  uint32_t tx_bytes_queued_;
+  uint32_t tx_bytes_charged_; // against the budget
+
+  // The IMU stream sends every imu_decimation_-th sample, chosen from the measured IMU rate
+  uint32_t imu_samples_seen_;
+  uint32_t imu_samples_window_start_;
+  uint32_t imu_decimation_;
+
+  // Batched IMU samples are scaled to 16 bits over +/-16 g and +/-2000 deg/s
+  static constexpr float IMU_BATCH_ACCEL_SCALE = 16.0f * 9.80665f / 32767.0f;
+  static constexpr float IMU_BATCH_GYRO_SCALE = 34.906585f / 32767.0f;
+
   typedef  void (Mavlink::*MavlinkStreamFcn)(void);
 
   typedef struct
@@ -84,18 +210,29 @@ private:
     uint32_t period_us;
     uint64_t next_time_us;
     MavlinkStreamFcn send_function;
+    uint8_t priority;         // share of the link when it is oversubscribed
+    uint16_t size_bytes;      // bytes sent the last time the stream ran
+    uint16_t deficit_bytes;   // deficit round robin credit
+    bool pending;             // due, but not sent yet
+    uint16_t sent_count;      // since the last status message
   } mavlink_stream_t;
 
   void handle_msg_param_request_list(void);
   void handle_msg_param_request_read(const mavlink_message_t *const msg);
   void handle_msg_param_set(const mavlink_message_t *const msg);
   void send_next_param(void);
+  void handle_msg_rosflight_param_bulk_request(const mavlink_message_t *const msg);
+  void send_next_param_chunk(void);
+  void fill_param_blob(uint8_t *dst, uint16_t offset, uint8_t length);
 
-  void handle_mavlink_message(void);
+  void handle_mavlink_message(const mavlink_message_t *const msg);
+  void parse_mavlink2_char(uint8_t c);
 
   void handle_msg_rosflight_cmd(const mavlink_message_t *const msg);
   void handle_msg_timesync(const mavlink_message_t *const msg);
   void handle_msg_offboard_control(const mavlink_message_t *const msg);
+  void update_host_clock(uint64_t now_us, int64_t host_ns);
+  uint64_t stamp_us(uint64_t time_us) const;
 
   void send_heartbeat(void);
   void send_status(void);
@@ -108,32 +245,55 @@ private:
   void send_sonar(void);
   void send_mag(void);
   void send_low_priority(void);
-  void send_message(const mavlink_message_t &msg);
+  void send_timesync(void);
+  void tx_start(uint16_t length);
+  void tx_bytes(const uint8_t *bytes, uint16_t length);
+  void tx_end(void);
+  void write_mavlink2_frame(const uint8_t *payload, uint8_t length);
+  void flush_tx(void);
   void send_log_message(uint8_t severity, const char *text);
+  void send_next_log(void);
+  void format_log(const log_entry_t &entry, char *text, uint8_t size);
   void stream_set_period(uint8_t stream_id, uint32_t period_us);
+  void send_stream_rates(void);
+  void update_imu_decimation(float window_s);
+  uint32_t imu_batch_size(void);
+  void send_imu_batch(uint32_t batch_size);
+
+  friend void mavlink_tx_start(uint16_t length);
+  friend void mavlink_tx_bytes(const uint8_t *data, uint16_t length);
+  friend void mavlink_tx_end(void);
 
   // Debugging Utils
   void send_named_value_int(const char *const name, int32_t value);
   //  void send_named_command_struct(const char *const name, control_t command_struct);
 
   mavlink_stream_t mavlink_streams_[STREAM_COUNT] = {
-    //  period_us    last_time_us   send_function
-    { 1000000,     0,             &rosflight_firmware::Mavlink::send_heartbeat },
-    { 1000000,     0,             &rosflight_firmware::Mavlink::send_status},
-    { 200000,      0,             &rosflight_firmware::Mavlink::send_attitude },
-    { 1000,        0,             &rosflight_firmware::Mavlink::send_imu },
-    { 200000,      0,             &rosflight_firmware::Mavlink::send_diff_pressure },
-    { 200000,      0,             &rosflight_firmware::Mavlink::send_baro },
-    { 100000,      0,             &rosflight_firmware::Mavlink::send_sonar },
-    { 6250,        0,             &rosflight_firmware::Mavlink::send_mag },
-    { 0,           0,             &rosflight_firmware::Mavlink::send_output_raw },
-    { 0,           0,             &rosflight_firmware::Mavlink::send_rc_raw },
-    { 5000,        0,             &rosflight_firmware::Mavlink::send_low_priority }
+    //  period_us    last_time_us   send_function                                          priority  size deficit pending sent
+    { 1000000,     0,             &rosflight_firmware::Mavlink::send_heartbeat,          4,        0,   0,      false,  0 },
+    { 1000000,     0,             &rosflight_firmware::Mavlink::send_status,             4,        0,   0,      false,  0 },
+    { 200000,      0,             &rosflight_firmware::Mavlink::send_attitude,           3,        0,   0,      false,  0 },
+    { 1000,        0,             &rosflight_firmware::Mavlink::send_imu,                3,        0,   0,      false,  0 },
+    { 200000,      0,             &rosflight_firmware::Mavlink::send_diff_pressure,      1,        0,   0,      false,  0 },
+    { 200000,      0,             &rosflight_firmware::Mavlink::send_baro,               1,        0,   0,      false,  0 },
+    { 100000,      0,             &rosflight_firmware::Mavlink::send_sonar,              1,        0,   0,      false,  0 },
+    { 6250,        0,             &rosflight_firmware::Mavlink::send_mag,                1,        0,   0,      false,  0 },
+    { 0,           0,             &rosflight_firmware::Mavlink::send_output_raw,         2,        0,   0,      false,  0 },
+    { 0,           0,             &rosflight_firmware::Mavlink::send_rc_raw,             2,        0,   0,      false,  0 },
+    { 5000,        0,             &rosflight_firmware::Mavlink::send_low_priority,       1,        0,   0,      false,  0 },
+    { 100000,      0,             &rosflight_firmware::Mavlink::send_timesync,           2,        0,   0,      false,  0 }
   };
 
 
 public:
 
+  enum
+  {
+    MAVLINK_VERSION_AUTO,
+    MAVLINK_VERSION_1,
+    MAVLINK_VERSION_2
+  };
+
   enum
   {
     LOG_INFO = 6,
@@ -143,14 +303,27 @@ public:
   };
 
   Mavlink(ROSflight &_rf);
+  ~Mavlink();
 
   void init();
   void receive(void);
   void stream();
   void update_param(uint16_t param_id);
   void set_streaming_rate(uint8_t stream_id, int16_t param_id);
+  void set_system_id(int16_t param_id);
+  void set_mavlink_version(int16_t param_id);
+  inline bool mavlink2() const { return mavlink2_; }
   void update_status();
+  // Supports %d, %u, %x, %X, %c and %s with a field width, and up to four arguments.  Strings
+  // passed for %s are read when the message is sent, so they have to outlive the call.
   void log(uint8_t severity, const char *fmt, ...);
+  inline uint32_t log_dropped() const { return log_dropped_; }
+  inline uint32_t tx_dropped_messages() const { return tx_dropped_messages_; }
+  inline uint32_t rx_budget_overruns() const { return rx_budget_overruns_; }
+  inline bool host_time_valid() const { return timesync_samples_ >= TIMESYNC_MIN_SAMPLES; }
+  inline float host_skew() const { return host_skew_; }
+  inline uint32_t timesync_rtt_us() const { return timesync_rtt_us_; }
+  uint64_t host_time_us(uint64_t time_us) const;
 
   void send_named_value_float(const char *const name, float value);
 };
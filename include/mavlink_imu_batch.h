@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROSFLIGHT_FIRMWARE_MAVLINK_IMU_BATCH_H
+#define ROSFLIGHT_FIRMWARE_MAVLINK_IMU_BATCH_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * ROSFLIGHT_IMU_BATCH is not yet part of the generated ROSflight dialect, so it is packed here the
+ * same way the generated code does it.  Once the dialect includes it, the generated definition
+ * takes over.  The dialect definition is:
+ *
+ *   <message id="199" name="ROSFLIGHT_IMU_BATCH">
+ *     <description>Consecutive IMU samples, scaled to 16 bits</description>
+ *     <field type="uint64_t" name="time_usec">Timestamp of the first sample (us)</field>
+ *     <field type="float" name="accel_scale">Acceleration per count (m/s^2)</field>
+ *     <field type="float" name="gyro_scale">Angular rate per count (rad/s)</field>
+ *     <field type="float" name="temperature">IMU temperature (deg C)</field>
+ *     <field type="uint16_t[8]" name="dt_us">Time of each sample after time_usec (us)</field>
+ *     <field type="int16_t[24]" name="accel">Acceleration x, y, z of each sample (counts)</field>
+ *     <field type="int16_t[24]" name="gyro">Angular rate x, y, z of each sample (counts)</field>
+ *     <field type="uint8_t" name="count">Number of valid samples</field>
+ *   </message>
+ */
+#ifndef MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH
+
+#define MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH 199
+#define MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN 133
+#define MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_CRC 133
+#define MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_DT_US_LEN 8
+#define MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_ACCEL_LEN 24
+#define MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_GYRO_LEN 24
+
+static inline void _mav_rosflight_imu_batch_put(char *buf, uint64_t time_usec, float accel_scale, float gyro_scale,
+                                                float temperature, const uint16_t *dt_us, const int16_t *accel,
+                                                const int16_t *gyro, uint8_t count)
+{
+  // Fields are on the wire largest type first, little-endian like both MAVLink and the targets
+  memcpy(&buf[0], &time_usec, sizeof(time_usec));
+  memcpy(&buf[8], &accel_scale, sizeof(accel_scale));
+  memcpy(&buf[12], &gyro_scale, sizeof(gyro_scale));
+  memcpy(&buf[16], &temperature, sizeof(temperature));
+  memcpy(&buf[20], dt_us, sizeof(uint16_t)*MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_DT_US_LEN);
+  memcpy(&buf[36], accel, sizeof(int16_t)*MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_ACCEL_LEN);
+  memcpy(&buf[84], gyro, sizeof(int16_t)*MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_GYRO_LEN);
+  memcpy(&buf[132], &count, sizeof(count));
+}
+
+static inline uint16_t mavlink_msg_rosflight_imu_batch_pack(uint8_t system_id, uint8_t component_id, mavlink_message_t *msg,
+                                                            uint64_t time_usec, float accel_scale, float gyro_scale,
+                                                            float temperature, const uint16_t *dt_us, const int16_t *accel,
+                                                            const int16_t *gyro, uint8_t count)
+{
+  _mav_rosflight_imu_batch_put(reinterpret_cast<char *>(msg->payload64), time_usec, accel_scale, gyro_scale,
+                               temperature, dt_us, accel, gyro, count);
+
+  msg->msgid = MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH;
+#if MAVLINK_CRC_EXTRA
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_CRC);
+#else
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN);
+#endif
+}
+
+#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+static inline void mavlink_msg_rosflight_imu_batch_send(mavlink_channel_t chan, uint64_t time_usec, float accel_scale,
+                                                        float gyro_scale, float temperature, const uint16_t *dt_us,
+                                                        const int16_t *accel, const int16_t *gyro, uint8_t count)
+{
+  char buf[MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN];
+  _mav_rosflight_imu_batch_put(buf, time_usec, accel_scale, gyro_scale, temperature, dt_us, accel, gyro, count);
+#if MAVLINK_CRC_EXTRA
+  _mav_finalize_message_chan_send(chan, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH, buf, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_CRC);
+#else
+  _mav_finalize_message_chan_send(chan, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH, buf, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN);
+#endif
+}
+
+#endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+#endif // MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH
+
+#endif // ROSFLIGHT_FIRMWARE_MAVLINK_IMU_BATCH_H
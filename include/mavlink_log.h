@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROSFLIGHT_FIRMWARE_MAVLINK_LOG_H
+#define ROSFLIGHT_FIRMWARE_MAVLINK_LOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * ROSFLIGHT_LOG is not yet part of the generated ROSflight dialect, so it is packed here the same
+ * way the generated code does it.  Once the dialect includes it, the generated definition takes
+ * over.  The dialect definition is:
+ *
+ *   <message id="196" name="ROSFLIGHT_LOG">
+ *     <description>Log message, to be expanded with the format string dictionary (log-dictionary.json)</description>
+ *     <field type="uint32_t" name="format_id">FNV-1a hash of the format string</field>
+ *     <field type="uint8_t" name="severity">Severity (MAV_SEVERITY)</field>
+ *     <field type="uint8_t[16]" name="args">Up to four 32-bit arguments, little-endian</field>
+ *   </message>
+ */
+#ifndef MAVLINK_MSG_ID_ROSFLIGHT_LOG
+
+#define MAVLINK_MSG_ID_ROSFLIGHT_LOG 196
+#define MAVLINK_MSG_ID_ROSFLIGHT_LOG_LEN 21
+#define MAVLINK_MSG_ID_ROSFLIGHT_LOG_CRC 83
+#define MAVLINK_MSG_ROSFLIGHT_LOG_FIELD_ARGS_LEN 16
+
+static inline void _mav_rosflight_log_put(char *buf, uint32_t format_id, uint8_t severity, const uint8_t *args)
+{
+  memcpy(&buf[0], &format_id, sizeof(format_id));
+  memcpy(&buf[4], &severity, sizeof(severity));
+  memcpy(&buf[5], args, MAVLINK_MSG_ROSFLIGHT_LOG_FIELD_ARGS_LEN);
+}
+
+static inline uint16_t mavlink_msg_rosflight_log_pack(uint8_t system_id, uint8_t component_id, mavlink_message_t *msg,
+                                                      uint32_t format_id, uint8_t severity, const uint8_t *args)
+{
+  _mav_rosflight_log_put(reinterpret_cast<char *>(msg->payload64), format_id, severity, args);
+
+  msg->msgid = MAVLINK_MSG_ID_ROSFLIGHT_LOG;
+#if MAVLINK_CRC_EXTRA
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_LOG_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_LOG_CRC);
+#else
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_LOG_LEN);
+#endif
+}
+
+#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+static inline void mavlink_msg_rosflight_log_send(mavlink_channel_t chan, uint32_t format_id, uint8_t severity,
+                                                  const uint8_t *args)
+{
+  char buf[MAVLINK_MSG_ID_ROSFLIGHT_LOG_LEN];
+  _mav_rosflight_log_put(buf, format_id, severity, args);
+#if MAVLINK_CRC_EXTRA
+  _mav_finalize_message_chan_send(chan, MAVLINK_MSG_ID_ROSFLIGHT_LOG, buf, MAVLINK_MSG_ID_ROSFLIGHT_LOG_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_LOG_CRC);
+#else
+  _mav_finalize_message_chan_send(chan, MAVLINK_MSG_ID_ROSFLIGHT_LOG, buf, MAVLINK_MSG_ID_ROSFLIGHT_LOG_LEN);
+#endif
+}
+
+#endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+#endif // MAVLINK_MSG_ID_ROSFLIGHT_LOG
+
+#endif // ROSFLIGHT_FIRMWARE_MAVLINK_LOG_H
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROSFLIGHT_FIRMWARE_MAVLINK_PARAM_BULK_H
+#define ROSFLIGHT_FIRMWARE_MAVLINK_PARAM_BULK_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The bulk parameter transfer messages are not yet part of the generated ROSflight dialect, so
+ * they are packed here the same way the generated code does it.  Once the dialect includes them,
+ * the generated definitions take over.  The dialect definitions are:
+ *
+ *   <message id="197" name="ROSFLIGHT_PARAM_BULK_REQUEST">
+ *     <description>Request all parameters as one blob, sent in ROSFLIGHT_PARAM_CHUNK messages</description>
+ *     <field type="uint32_t" name="table_hash">Table hash of the client's cached names, 0 if none</field>
+ *     <field type="uint8_t" name="target_system">System ID</field>
+ *     <field type="uint8_t" name="target_component">Component ID</field>
+ *   </message>
+ *   <message id="198" name="ROSFLIGHT_PARAM_CHUNK">
+ *     <description>Part of the parameter blob</description>
+ *     <field type="uint32_t" name="table_hash">Hash of the parameter names and types</field>
+ *     <field type="uint16_t" name="blob_length">Length of the whole blob</field>
+ *     <field type="uint16_t" name="offset">Offset of this chunk in the blob</field>
+ *     <field type="uint16_t" name="chunk_crc">CRC-16/MCRF4XX of the chunk data</field>
+ *     <field type="uint8_t" name="length">Number of valid bytes in data</field>
+ *     <field type="uint8_t[128]" name="data">Chunk data</field>
+ *   </message>
+ */
+#ifndef MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST
+
+#define MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST 197
+#define MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_LEN 6
+#define MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_CRC 211
+
+typedef struct
+{
+  uint32_t table_hash;
+  uint8_t target_system;
+  uint8_t target_component;
+} mavlink_rosflight_param_bulk_request_t;
+
+static inline uint16_t mavlink_msg_rosflight_param_bulk_request_pack(uint8_t system_id, uint8_t component_id,
+                                                                    mavlink_message_t *msg, uint32_t table_hash,
+                                                                    uint8_t target_system, uint8_t target_component)
+{
+  char *buf = reinterpret_cast<char *>(msg->payload64);
+  memcpy(&buf[0], &table_hash, sizeof(table_hash));
+  memcpy(&buf[4], &target_system, sizeof(target_system));
+  memcpy(&buf[5], &target_component, sizeof(target_component));
+
+  msg->msgid = MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST;
+#if MAVLINK_CRC_EXTRA
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_CRC);
+#else
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_LEN);
+#endif
+}
+
+static inline void mavlink_msg_rosflight_param_bulk_request_decode(const mavlink_message_t *msg,
+                                                                   mavlink_rosflight_param_bulk_request_t *request)
+{
+  const char *buf = reinterpret_cast<const char *>(msg->payload64);
+  memcpy(&request->table_hash, &buf[0], sizeof(request->table_hash));
+  memcpy(&request->target_system, &buf[4], sizeof(request->target_system));
+  memcpy(&request->target_component, &buf[5], sizeof(request->target_component));
+}
+
+#endif // MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST
+
+#ifndef MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK
+
+#define MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK 198
+#define MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN 139
+#define MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_CRC 10
+#define MAVLINK_MSG_ROSFLIGHT_PARAM_CHUNK_FIELD_DATA_LEN 128
+
+static inline void _mav_rosflight_param_chunk_put(char *buf, uint32_t table_hash, uint16_t blob_length, uint16_t offset,
+                                                  uint16_t chunk_crc, uint8_t length, const uint8_t *data)
+{
+  memcpy(&buf[0], &table_hash, sizeof(table_hash));
+  memcpy(&buf[4], &blob_length, sizeof(blob_length));
+  memcpy(&buf[6], &offset, sizeof(offset));
+  memcpy(&buf[8], &chunk_crc, sizeof(chunk_crc));
+  memcpy(&buf[10], &length, sizeof(length));
+  memcpy(&buf[11], data, MAVLINK_MSG_ROSFLIGHT_PARAM_CHUNK_FIELD_DATA_LEN);
+}
+
+static inline uint16_t mavlink_msg_rosflight_param_chunk_pack(uint8_t system_id, uint8_t component_id, mavlink_message_t *msg,
+                                                              uint32_t table_hash, uint16_t blob_length, uint16_t offset,
+                                                              uint16_t chunk_crc, uint8_t length, const uint8_t *data)
+{
+  _mav_rosflight_param_chunk_put(reinterpret_cast<char *>(msg->payload64), table_hash, blob_length, offset, chunk_crc,
+                                 length, data);
+
+  msg->msgid = MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK;
+#if MAVLINK_CRC_EXTRA
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_CRC);
+#else
+  return mavlink_finalize_message(msg, system_id, component_id, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN);
+#endif
+}
+
+#ifdef MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+static inline void mavlink_msg_rosflight_param_chunk_send(mavlink_channel_t chan, uint32_t table_hash, uint16_t blob_length,
+                                                          uint16_t offset, uint16_t chunk_crc, uint8_t length,
+                                                          const uint8_t *data)
+{
+  char buf[MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN];
+  _mav_rosflight_param_chunk_put(buf, table_hash, blob_length, offset, chunk_crc, length, data);
+#if MAVLINK_CRC_EXTRA
+  _mav_finalize_message_chan_send(chan, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK, buf, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN,
+                                  MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_CRC);
+#else
+  _mav_finalize_message_chan_send(chan, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK, buf, MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN);
+#endif
+}
+
+#endif // MAVLINK_USE_CONVENIENCE_FUNCTIONS
+
+#endif // MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK
+
+#endif // ROSFLIGHT_FIRMWARE_MAVLINK_PARAM_BULK_H
@@ -36,6 +36,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "dshot.h"
+
+// Number of mixer outputs, boards with more timer channels can raise this at compile time
+#ifndef ROSFLIGHT_NUM_OUTPUTS
+#define ROSFLIGHT_NUM_OUTPUTS 8
+#endif
+
 namespace rosflight_firmware
 {
 
@@ -46,6 +53,10 @@ class Mixer
 
 public:
 
+  static constexpr uint8_t NUM_OUTPUTS = ROSFLIGHT_NUM_OUTPUTS;
+  static_assert(NUM_OUTPUTS >= 8, "the built-in mixers drive up to 8 outputs");
+  static_assert(NUM_OUTPUTS <= 16, "output types are packed into 32 bits");
+
   enum
   {
     ESC_CALIBRATION = 0,
@@ -59,6 +70,7 @@ public:
     X8 = 8,
     TRICOPTER = 9,
     FIXEDWING = 10,
+    CUSTOM = 11,
     NUM_MIXERS,
     INVALID_MIXER = 255
   };
@@ -73,23 +85,92 @@ public:
 
   typedef struct
   {
-    output_type_t output_type[8];
-    float F[8];
-    float x[8];
-    float y[8];
-    float z[8];
+    output_type_t output_type[NUM_OUTPUTS];
+    float F[NUM_OUTPUTS];
+    float x[NUM_OUTPUTS];
+    float y[NUM_OUTPUTS];
+    float z[NUM_OUTPUTS];
   } mixer_t;
 
-private:
-  ROSflight& RF_;
+  static constexpr uint8_t NO_FAILURE = 255;
 
-  float raw_outputs_[8];
-  float unsaturated_outputs_[8];
+  static bool invert_4x4(float A[4][4], float inverse[4][4]);
 
-  void write_motor(uint8_t index, float value);
-  void write_servo(uint8_t index, float value);
+private:
+  ROSflight& RF_;
 
-  const mixer_t esc_calibration_mixing =
+  float raw_outputs_[NUM_OUTPUTS];
+  float unsaturated_outputs_[NUM_OUTPUTS];
+  float mixed_outputs_[NUM_OUTPUTS]; // clamped, but motors are still in thrust rather than throttle
+
+  // Custom mixer coefficients are stored in params as Q2.13 fixed-point
+  static constexpr float CUSTOM_MIXER_SCALE = 1.0f / 8192.0f;
+  static constexpr uint8_t NUM_CUSTOM_OUTPUTS = 8;
+
+  // Expanded from params by init_custom_mixing(), so it has to live in RAM
+  mixer_t custom_mixing_;
+
+  bool airmode_active_;
+
+  // Output limits indexed by [armed][output], and the PWM scaling of each output, are
+  // recomputed only when the mixer or motor params change
+  float output_min_[2][NUM_OUTPUTS];
+  float output_max_[2][NUM_OUTPUTS];
+  float pwm_scale_[NUM_OUTPUTS];
+  float pwm_offset_[NUM_OUTPUTS];
+  uint8_t motor_outputs_[NUM_OUTPUTS]; // indices of the motor outputs, so mixing needn't test types
+  uint8_t num_motor_outputs_;
+  float motor_idle_;
+  uint16_t pwm_outputs_[NUM_OUTPUTS];
+
+  // Thrust curve lookup (desired thrust to throttle) and battery compensation, also only
+  // recomputed when params change
+  static constexpr uint8_t THRUST_CURVE_SEGMENTS = 16;
+  static constexpr float BATTERY_SCALE_MIN = 0.5f;
+  static constexpr float BATTERY_SCALE_MAX = 1.5f;
+  float thrust_curve_[THRUST_CURVE_SEGMENTS + 1];
+  float thrust_expo_;
+  float battery_reference_;
+
+  // DShot motor output, dshot_bit_ticks_ is 0 when using PWM
+  uint16_t dshot_bit_ticks_;
+  bool dshot_bidirectional_;
+  float erpm_to_rpm_;
+  uint16_t dshot_buffers_[NUM_OUTPUTS * DShot::BUFFER_LENGTH]; // clocked out with DMA, so it outlives mix_output()
+  float motor_rpm_[NUM_OUTPUTS];
+
+  // Motor failure handling: the least-squares fit for each motor that could be lost is computed by
+  // init_mixing(), so reallocating after a failure only has to expand one reduced mixer from it.
+  // Only a 4x4 matrix is kept per motor, for mixers of up to FAILURE_MAX_MOTORS motors.
+  static constexpr uint8_t FAILURE_MIN_MOTORS = 6;
+  static constexpr uint8_t FAILURE_MAX_MOTORS = 8;
+  static constexpr float FAILURE_MIN_OUTPUT = 0.25f; // motors commanded below this are not checked
+  static constexpr float FAILURE_MIN_RPM = 1000.0f;
+  static constexpr uint64_t FAILURE_TELEMETRY_TIMEOUT_US = 50000;
+  static constexpr uint64_t FAILURE_DETECTION_TIME_US = 200000;
+  float failure_fit_[FAILURE_MAX_MOTORS][4][4];
+  uint8_t failure_fit_index_[NUM_OUTPUTS]; // NO_FAILURE if there is no reduced mixer for the motor
+  mixer_t failure_mixing_;
+  const mixer_t *nominal_mixer_;
+  uint8_t failed_motor_;
+  uint64_t motor_telemetry_us_[NUM_OUTPUTS];
+  uint64_t motor_fault_start_us_[NUM_OUTPUTS];
+
+  void init_custom_mixing();
+  void init_failure_mixing();
+  void build_failure_mixing(uint8_t failed_motor);
+  void detect_motor_failure(uint64_t now_us, bool armed);
+  void init_output_scaling();
+  void desaturate_motors(float throttle, const float *thrust, float *roll_pitch, const float *yaw,
+                         float lower, float upper);
+  float throttle_shift(float out_min, float out_max, float lower, float upper, bool airmode);
+  float battery_scale();
+  float thrust_to_throttle(float thrust) const;
+  inline float throttle_to_thrust(float throttle) const { return (1.0f - thrust_expo_ + thrust_expo_*throttle)*throttle; }
+  void read_dshot_telemetry(uint64_t now_us);
+  void write_dshot(bool armed);
+
+  static constexpr mixer_t esc_calibration_mixing =
   {
     {M, M, M, M, M, M, NONE, NONE},
     { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f}, // F Mix
@@ -98,7 +179,7 @@ private:
     { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}, // X Mix
   };
 
-  const mixer_t quadcopter_plus_mixing =
+  static constexpr mixer_t quadcopter_plus_mixing =
   {
     {M, M, M, M, NONE, NONE, NONE, NONE}, // output_type
 
@@ -108,7 +189,7 @@ private:
     { 1.0f, -1.0f,  1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f}  // Z Mix
   };
 
-  const mixer_t quadcopter_x_mixing =
+  static constexpr mixer_t quadcopter_x_mixing =
   {
     {M, M, M, M, NONE, NONE, NONE, NONE}, // output_type
 
@@ -118,7 +199,7 @@ private:
     { 1.0f, -1.0f, 1.0f,-1.0f,  0.0f, 0.0f, 0.0f, 0.0f}  // Z Mix
   };
 
-  const mixer_t hex_plus_mixing =
+  static constexpr mixer_t hex_plus_mixing =
   {
     {M, M, M, M, M, M, M, M}, // output_type
 
@@ -128,7 +209,7 @@ private:
     { 1.0f, -1.0f,       1.0f,     -1.0f,  1.0f,     -1.0f,      0.0f, 0.0f}  //  Z  Mix
   };
 
-  const mixer_t hex_x_mixing =
+  static constexpr mixer_t hex_x_mixing =
   {
     {M, M, M, M, M, M, M, M}, // output_type
 
@@ -138,7 +219,7 @@ private:
     {  1.0f,       -1.0f,  1.0f,      -1.0f,      1.0f, -1.0f,      0.0f,  0.0f}  //  Z  Mix
   };
 
-  const mixer_t octocopter_plus_mixing =
+  static constexpr mixer_t octocopter_plus_mixing =
   {
     {M, M, M, M, M, M, M, M}, // output_type
 
@@ -148,7 +229,7 @@ private:
     { 1.0f,  -1.0f,    1.0f,  -1.0f,     1.0f,  -1.0f,    1.0f, -1.0f}     //  Z  Mix
   };
 
-  const mixer_t octocopter_x_mixing =
+  static constexpr mixer_t octocopter_x_mixing =
   {
     {M, M, M, M, M, M, M, M}, // output_type
 
@@ -158,7 +239,7 @@ private:
     { 1.0f,   -1.0f,    1.0f,   -1.0f,   1.0f,  -1.0f,    1.0f,  -1.0f}   // Z Mix
   };
 
-  const mixer_t Y6_mixing =
+  static constexpr mixer_t Y6_mixing =
   {
     {M, M, M, M, M, M, NONE, NONE}, // output_type
 
@@ -168,7 +249,7 @@ private:
     { 1.0f,  -1.0f,    1.0f,   -1.0f,    1.0f,   -1.0f,   0.0f, 0.0f}  // Z Mix
   };
 
-  const mixer_t X8_mixing =
+  static constexpr mixer_t X8_mixing =
   {
     {M, M, M, M, M, M, M, M}, // output_type
 
@@ -178,7 +259,7 @@ private:
     { 1.0f, -1.0f,  1.0f, -1.0f,  1.0f, -1.0f,  1.0f, -1.0f}  // Z Mix
   };
 
-  const mixer_t tricopter_mixing =
+  static constexpr mixer_t tricopter_mixing =
   {
     {M, M, M, S, NONE, NONE, NONE, NONE}, // output_type
 
@@ -188,7 +269,7 @@ private:
     { 0.0f,   1.0f, 0.0f,    0.0f,   0.0f, 0.0f, 0.0f, 0.0f}  // Z Mix
   };
 
-  const mixer_t fixedwing_mixing =
+  static constexpr mixer_t fixedwing_mixing =
   {
     {S, S, M, S, S, M, NONE, NONE},
 
@@ -201,7 +282,7 @@ private:
 
   const mixer_t *mixer_to_use_;
 
-  const mixer_t *array_of_mixers_[NUM_MIXERS] =
+  static constexpr const mixer_t *array_of_mixers_[NUM_MIXERS] =
   {
     &esc_calibration_mixing,
     &quadcopter_plus_mixing,
@@ -214,6 +295,7 @@ private:
     &X8_mixing,
     &tricopter_mixing,
     &fixedwing_mixing,
+    nullptr, // custom_mixing_
   };
 
 public:
@@ -224,6 +306,11 @@ public:
   void mix_output();
   void param_change_callback(uint16_t param_id);
   inline const float* get_outputs() const {return raw_outputs_;}
+  inline const float* get_mixed_outputs() const {return mixed_outputs_;}
+  inline const uint16_t* get_pwm_outputs() const {return pwm_outputs_;}
+  inline const mixer_t* get_mixer() const {return mixer_to_use_;}
+  inline const float* get_motor_rpm() const {return motor_rpm_;}
+  inline uint8_t get_failed_motor() const {return failed_motor_;}
 };
 
 } // namespace rosflight_firmware
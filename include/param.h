@@ -54,16 +54,21 @@ enum : uint16_t
   /*** HARDWARE CONFIGURATION ***/
   /******************************/
   PARAM_BAUD_RATE = 0,
+  PARAM_BLACKBOX,
 
   /*****************************/
   /*** MAVLINK CONFIGURATION ***/
   /*****************************/
   PARAM_SYSTEM_ID,
+  PARAM_MAVLINK_VERSION,
+  PARAM_LOG_BINARY,
+  PARAM_TIMESYNC_STAMP,
   PARAM_STREAM_HEARTBEAT_RATE,
   PARAM_STREAM_STATUS_RATE,
 
   PARAM_STREAM_ATTITUDE_RATE,
   PARAM_STREAM_IMU_RATE,
+  PARAM_STREAM_IMU_BATCH,
   PARAM_STREAM_MAG_RATE,
   PARAM_STREAM_BARO_RATE,
   PARAM_STREAM_AIRSPEED_RATE,
@@ -71,6 +76,7 @@ enum : uint16_t
 
   PARAM_STREAM_OUTPUT_RAW_RATE,
   PARAM_STREAM_RC_RAW_RATE,
+  PARAM_STREAM_TIMESYNC_RATE,
 
   /********************************/
   /*** CONTROLLER CONFIGURATION ***/
@@ -103,6 +109,38 @@ enum : uint16_t
 
   PARAM_PID_TAU,
 
+  PARAM_ATT_CONTROL_QUATERNION,
+
+  PARAM_GAIN_SCHEDULE,
+  PARAM_GAIN_SCHEDULE_BP_0,
+  PARAM_GAIN_SCHEDULE_BP_1,
+  PARAM_GAIN_SCHEDULE_BP_2,
+  PARAM_GAIN_SCHEDULE_ROLL_ANGLE_0,
+  PARAM_GAIN_SCHEDULE_ROLL_ANGLE_1,
+  PARAM_GAIN_SCHEDULE_ROLL_ANGLE_2,
+  PARAM_GAIN_SCHEDULE_ROLL_RATE_0,
+  PARAM_GAIN_SCHEDULE_ROLL_RATE_1,
+  PARAM_GAIN_SCHEDULE_ROLL_RATE_2,
+  PARAM_GAIN_SCHEDULE_PITCH_ANGLE_0,
+  PARAM_GAIN_SCHEDULE_PITCH_ANGLE_1,
+  PARAM_GAIN_SCHEDULE_PITCH_ANGLE_2,
+  PARAM_GAIN_SCHEDULE_PITCH_RATE_0,
+  PARAM_GAIN_SCHEDULE_PITCH_RATE_1,
+  PARAM_GAIN_SCHEDULE_PITCH_RATE_2,
+  PARAM_GAIN_SCHEDULE_YAW_RATE_0,
+  PARAM_GAIN_SCHEDULE_YAW_RATE_1,
+  PARAM_GAIN_SCHEDULE_YAW_RATE_2,
+
+  PARAM_AUTOTUNE_RELAY,
+  PARAM_AUTOTUNE_HYSTERESIS,
+  PARAM_AUTOTUNE_RULE,
+
+  PARAM_INDI,
+  PARAM_INDI_EFFECTIVENESS_ROLL,
+  PARAM_INDI_EFFECTIVENESS_PITCH,
+  PARAM_INDI_EFFECTIVENESS_YAW,
+  PARAM_INDI_ALPHA,
+
   /*************************/
   /*** PWM CONFIGURATION ***/
   /*************************/
@@ -112,6 +150,14 @@ enum : uint16_t
   PARAM_MOTOR_MAX_PWM,
   PARAM_MOTOR_MIN_PWM,
   PARAM_SPIN_MOTORS_WHEN_ARMED,
+  PARAM_MIXER_AIRMODE,
+  PARAM_MOTOR_PROTOCOL,
+  PARAM_DSHOT_BIDIRECTIONAL,
+  PARAM_MOTOR_POLES,
+  PARAM_MOTOR_FAILURE_DETECTION,
+  PARAM_THRUST_EXPO,
+  PARAM_BATTERY_VOLTAGE_REFERENCE,
+  PARAM_BATTERY_VOLTAGE_ALPHA,
 
   /*******************************/
   /*** ESTIMATOR CONFIGURATION ***/
@@ -192,6 +238,24 @@ enum : uint16_t
   /***************************/
   PARAM_MIXER,
 
+  PARAM_CUSTOM_MIXER_TYPES,
+  PARAM_CUSTOM_MIXER_0_FX,
+  PARAM_CUSTOM_MIXER_0_YZ,
+  PARAM_CUSTOM_MIXER_1_FX,
+  PARAM_CUSTOM_MIXER_1_YZ,
+  PARAM_CUSTOM_MIXER_2_FX,
+  PARAM_CUSTOM_MIXER_2_YZ,
+  PARAM_CUSTOM_MIXER_3_FX,
+  PARAM_CUSTOM_MIXER_3_YZ,
+  PARAM_CUSTOM_MIXER_4_FX,
+  PARAM_CUSTOM_MIXER_4_YZ,
+  PARAM_CUSTOM_MIXER_5_FX,
+  PARAM_CUSTOM_MIXER_5_YZ,
+  PARAM_CUSTOM_MIXER_6_FX,
+  PARAM_CUSTOM_MIXER_6_YZ,
+  PARAM_CUSTOM_MIXER_7_FX,
+  PARAM_CUSTOM_MIXER_7_YZ,
+
   PARAM_FIXED_WING,
   PARAM_ELEVATOR_REVERSE,
   PARAM_AILERON_REVERSE,
@@ -229,26 +293,60 @@ private:
 
   typedef struct
   {
-    uint32_t version;
-    uint16_t size;
-    uint8_t magic_be;                       // magic number, should be 0xBE
-
     param_value_t values[PARAMS_COUNT];
     char names[PARAMS_COUNT][PARAMS_NAME_LENGTH];
     param_type_t types[PARAMS_COUNT];
-
-    uint8_t magic_ef;                       // magic number, should be 0xEF
-    uint8_t chk;                            // XOR checksum
   } params_t;
 
+  // Values are stored in one of two banks, each half of the board's memory sectors.  A bank holds
+  // a snapshot of every value, then a journal of the values saved since, one record per change.
+  // When the journal fills up, a new snapshot is written to the other bank, which takes over once
+  // it is complete.  Names and types come from the firmware, so a bank is only used if it was
+  // written for the same parameter table.
+  typedef struct
+  {
+    uint32_t magic;
+    uint32_t table_hash;
+    uint32_t sequence;    // the bank with the higher sequence is the newer one
+    uint32_t crc;         // CRC32 of the fields above and the snapshot
+  } storage_header_t;
+
+  typedef struct
+  {
+    uint32_t id;
+    param_value_t value;
+    uint32_t crc;         // CRC32 of the id and value
+  } journal_record_t;
+
+  static constexpr uint32_t STORAGE_MAGIC = 0x31504652; // "RFP1"
+  static constexpr uint32_t SNAPSHOT_OFFSET = sizeof(storage_header_t);
+  static constexpr uint32_t JOURNAL_OFFSET = SNAPSHOT_OFFSET + PARAMS_COUNT * sizeof(param_value_t);
+  static constexpr uint8_t NO_BANK = 0xFF;
+  uint8_t storage_bank_;       // the bank in use, NO_BANK if none is valid
+  uint32_t storage_sequence_;
+  uint32_t journal_end_;       // where the next record goes, from the start of the bank
+  uint32_t dirty_[(PARAMS_COUNT + 31) / 32]; // changed since they were last read or written
+
   std::function<void(int)> callbacks[PARAMS_COUNT]; // Param change callbacks
 
   params_t params;
+  uint32_t table_hash_;
+
+  // Parameter IDs in order of name, so a name is found by binary search
+  static_assert(PARAMS_COUNT <= UINT8_MAX, "the name index holds 8-bit IDs");
+  uint8_t name_index_[PARAMS_COUNT];
   ROSflight& RF_;
 
   void init_param_int(uint16_t id, const char name[PARAMS_NAME_LENGTH], int32_t value);
   void init_param_float(uint16_t id, const char name[PARAMS_NAME_LENGTH], float value);
-  uint8_t compute_checksum(void);
+  uint32_t compute_table_hash(void);
+  uint32_t bank_size(void);
+  bool read_bank(uint8_t bank, storage_header_t *header);
+  bool write_snapshot(void);
+  inline void set_dirty(uint16_t id) { dirty_[id / 32] |= 1u << (id % 32); }
+  inline bool is_dirty(uint16_t id) const { return dirty_[id / 32] & (1u << (id % 32)); }
+  void clear_dirty(void);
+  void build_name_index(void);
 
 
 public:
@@ -277,7 +375,7 @@ public:
   bool read(void);
 
   /**
-   * @brief Write current parameter values to non-volatile memory
+   * @brief Write the parameter values changed since the last read or write to non-volatile memory
    * @return True if successful, false otherwise
    */
   bool write(void);
@@ -326,6 +424,12 @@ public:
    */
   inline param_type_t get_param_type(uint16_t id) const { return params.types[id]; }
 
+  /**
+   * @brief Get a hash of the parameter names and types
+   * @return The hash, which changes whenever the parameter table does
+   */
+  inline uint32_t get_table_hash() const { return table_hash_; }
+
   /**
    * @brief Sets the value of a parameter by ID and calls the parameter change callback
    * @param id The ID of the parameter
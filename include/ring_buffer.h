@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROSFLIGHT_FIRMWARE_RING_BUFFER_H
+#define ROSFLIGHT_FIRMWARE_RING_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <atomic>
+
+namespace rosflight_firmware
+{
+
+/**
+ * @brief Lock-free single-producer/single-consumer byte queue
+ *
+ * The producer only ever writes head_ and the consumer only ever writes tail_, so one side can run
+ * in an interrupt without either side disabling interrupts.  The indices run freely and wrap at
+ * 2^16, which is why SIZE has to be a power of two.
+ */
+template <uint16_t SIZE>
+class RingBuffer
+{
+  static_assert((SIZE & (SIZE - 1)) == 0, "ring buffer size must be a power of two");
+
+public:
+  RingBuffer() : head_(0), tail_(0), write_head_(0) {}
+
+  inline uint16_t size() const { return static_cast<uint16_t>(head_ - tail_); }
+  inline uint16_t space() const { return static_cast<uint16_t>(SIZE - size()); }
+  inline bool empty() const { return head_ == tail_; }
+
+  // Producer: queue all of len bytes, or none of them if they don't fit
+  bool push(const uint8_t *src, uint16_t len)
+  {
+    if (!reserve(len))
+      return false;
+    write(src, len);
+    commit();
+    return true;
+  }
+
+  // Producer: make sure len bytes fit, then fill them in with write() and publish them with
+  // commit(), so data can be serialized straight into the buffer
+  inline bool reserve(uint16_t len)
+  {
+    write_head_ = head_;
+    return len <= space();
+  }
+
+  void write(const uint8_t *src, uint16_t len)
+  {
+    uint16_t start = write_head_ & (SIZE - 1);
+    uint16_t first = (len < SIZE - start) ? len : static_cast<uint16_t>(SIZE - start);
+    memcpy(&buffer_[start], src, first);
+    memcpy(buffer_, src + first, len - first);
+    write_head_ = static_cast<uint16_t>(write_head_ + len);
+  }
+
+  inline void commit()
+  {
+    // The data has to be in place before the consumer can see the new head
+    std::atomic_signal_fence(std::memory_order_release);
+    head_ = write_head_;
+  }
+
+  // Consumer: the queued bytes that are contiguous in memory, starting with the oldest
+  const uint8_t *peek(uint16_t *len) const
+  {
+    uint16_t start = tail_ & (SIZE - 1);
+    uint16_t available = size();
+    *len = (available < SIZE - start) ? available : static_cast<uint16_t>(SIZE - start);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    return &buffer_[start];
+  }
+
+  // Consumer: release len bytes returned by peek()
+  void pop(uint16_t len)
+  {
+    std::atomic_signal_fence(std::memory_order_release);
+    tail_ = static_cast<uint16_t>(tail_ + len);
+  }
+
+private:
+  uint8_t buffer_[SIZE];
+  volatile uint16_t head_;
+  volatile uint16_t tail_;
+  uint16_t write_head_; // producer only, where write() puts the next byte
+};
+
+// A buffer that has been compiled out takes no RAM and never has room
+template <>
+class RingBuffer<0>
+{
+public:
+  inline uint16_t size() const { return 0; }
+  inline uint16_t space() const { return 0; }
+  inline bool empty() const { return true; }
+  inline bool push(const uint8_t *, uint16_t len) { return len == 0; }
+  inline bool reserve(uint16_t len) { return len == 0; }
+  inline void write(const uint8_t *, uint16_t) {}
+  inline void commit() {}
+  inline const uint8_t *peek(uint16_t *len) const
+  {
+    *len = 0;
+    return nullptr;
+  }
+  inline void pop(uint16_t) {}
+};
+
+} // namespace rosflight_firmware
+
+#endif // ROSFLIGHT_FIRMWARE_RING_BUFFER_H
@@ -42,6 +42,7 @@
 #include "mixer.h"
 #include "state_manager.h"
 #include "command_manager.h"
+#include "logger.h"
 
 namespace rosflight_firmware
 {
@@ -67,6 +68,7 @@ public:
   RC rc_;
   Sensors sensors_;
   StateManager state_manager_;
+  Logger logger_;
 
   uint32_t loop_time_us;
 
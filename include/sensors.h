@@ -68,12 +68,25 @@ public:
 
     turbomath::Vector mag = {0, 0, 0};
 
+    float battery_voltage = 0;
+
     bool baro_present = false;
     bool mag_present = false;
     bool sonar_present = false;
     bool diff_pressure_present = false;
+    bool battery_present = false;
+  };
+
+  struct ImuSample
+  {
+    uint64_t time_us;
+    turbomath::Vector accel;
+    turbomath::Vector gyro;
   };
 
+  // Number of past IMU samples kept for streaming them in batches
+  static constexpr uint8_t IMU_HISTORY_LENGTH = 16;
+
   Sensors(ROSflight& rosflight);
 
   inline const Data& data() const { return data_; }
@@ -89,14 +102,10 @@ public:
   bool start_diff_pressure_calibration(void);
   bool gyro_calibration_complete(void);
 
-  inline bool should_send_imu_data(void)
-  {
-    if (imu_data_sent_)
-      return false;
-    else
-      imu_data_sent_ = true;
-    return true;
-  }
+  // Incremented for every IMU sample read, so consumers can tell a new sample from one they
+  // have already seen
+  inline uint32_t imu_sample_count(void) const { return imu_sample_count_; }
+  bool imu_sample(uint32_t sample_number, ImuSample *sample) const;
 
 private:
   static const float BARO_MAX_CHANGE_RATE;
@@ -109,6 +118,7 @@ private:
   static const int SENSOR_CAL_CYCLES;
   static const float BARO_MAX_CALIBRATION_VARIANCE;
   static const float DIFF_PRESSURE_MAX_CALIBRATION_VARIANCE;
+  static const float BATTERY_MIN_VOLTAGE;
 
   class OutlierFilter
   {
@@ -130,6 +140,7 @@ private:
     DIFF_PRESSURE,
     SONAR,
     MAGNETOMETER,
+    BATTERY,
     NUM_LOW_PRIORITY_SENSORS
   };
 
@@ -158,7 +169,8 @@ private:
   uint32_t last_imu_update_ms_ = 0;
 
   bool new_imu_data_;
-  bool imu_data_sent_;
+  uint32_t imu_sample_count_;
+  ImuSample imu_history_[IMU_HISTORY_LENGTH];
 
   // IMU calibration
   uint16_t gyro_calibration_count_ = 0;
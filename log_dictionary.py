@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+#
+# Builds the dictionary the onboard computer uses to expand ROSFLIGHT_LOG messages (sent when
+# LOG_BINARY is set) back into text.  Each log format string in the firmware is keyed by its
+# 32-bit FNV-1a hash, which is the format_id the firmware sends.
+#
+# Usage: log_dictionary.py [output file, log-dictionary.json by default]
+#
+__author__ = "ROSflight"
+__copyright__ = "Copyright 2017, ROSflight"
+__license__ = "BSD-3"
+
+import glob
+import json
+import re
+import sys
+
+
+def format_id(fmt):
+    h = 2166136261
+    for c in bytearray(fmt.encode('utf-8')):
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h
+
+severities = {'LOG_CRITICAL': 2, 'LOG_ERROR': 3, 'LOG_WARNING': 4, 'LOG_INFO': 6}
+
+dictionary = dict()
+for filename in sorted(glob.glob('src/*.cpp')):
+    text = open(filename).read()
+    for match in re.finditer(r'\blog\(\s*(?:Mavlink::)?(LOG_\w+)\s*,\s*"((?:[^"\\]|\\.)*)"', text):
+        fmt = match.group(2).encode('utf-8').decode('unicode_escape')
+        line = text.count('\n', 0, match.start()) + 1
+        dictionary['0x%08X' % format_id(fmt)] = {'format': fmt,
+                                                 'severity': severities[match.group(1)],
+                                                 'source': '%s:%d' % (filename, line)}
+
+out = open(sys.argv[1] if len(sys.argv) > 1 else 'log-dictionary.json', 'w')
+json.dump(dictionary, out, indent=2, sort_keys=True)
+out.write('\n')
+out.close()
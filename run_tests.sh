@@ -32,6 +32,10 @@ echo_blue "Test 3: Run test suite"
 ./unit_tests
 print_result $?
 
+echo_blue "Test 4: Run test suite with 16 outputs"
+./unit_tests_16_outputs
+print_result $?
+
 
 if [ $EXIT_CODE -eq 0 ]; then
   echo_green "All tests passed!"
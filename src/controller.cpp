@@ -42,7 +42,8 @@ namespace rosflight_firmware
 {
 
 Controller::Controller(ROSflight& rf) :
-  RF_(rf)
+  RF_(rf),
+  autotune_axis_(AUTOTUNE_NONE)
 {
   RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), PARAM_PID_ROLL_ANGLE_P);
   RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), PARAM_PID_ROLL_ANGLE_I);
@@ -61,12 +62,20 @@ Controller::Controller(ROSflight& rf) :
   RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), PARAM_PID_YAW_RATE_D);
   RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), PARAM_MAX_COMMAND);
   RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), PARAM_PID_TAU);
+  for (uint16_t id = PARAM_GAIN_SCHEDULE; id <= PARAM_GAIN_SCHEDULE_YAW_RATE_2; id++)
+    RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), id);
+  for (uint16_t id = PARAM_INDI; id <= PARAM_INDI_ALPHA; id++)
+    RF_.params_.add_callback(std::bind(&Controller::param_change_callback, this, std::placeholders::_1), id);
 }
 
 void Controller::init()
 {
   prev_time_us_ = 0;
 
+  down_command_ = turbomath::Vector(0.0f, 0.0f, 1.0f);
+  roll_command_ = 0.0f;
+  pitch_command_ = 0.0f;
+
   float max = RF_.params_.get_param_float(PARAM_MAX_COMMAND);
   float min = -max;
   float tau = RF_.params_.get_param_float(PARAM_PID_TAU);
@@ -91,6 +100,126 @@ void Controller::init()
                  RF_.params_.get_param_float(PARAM_PID_YAW_RATE_I),
                  RF_.params_.get_param_float(PARAM_PID_YAW_RATE_D),
                  max, min, tau);
+
+  init_gain_schedule();
+  init_indi();
+}
+
+void Controller::init_indi()
+{
+  indi_enabled_ = RF_.params_.get_param_int(PARAM_INDI) && !RF_.params_.get_param_int(PARAM_FIXED_WING);
+  indi_alpha_ = RF_.params_.get_param_float(PARAM_INDI_ALPHA);
+  indi_max_ = RF_.params_.get_param_float(PARAM_MAX_COMMAND);
+
+  // A zero or negative effectiveness would send inf or NaN to the motors, so use the PID output
+  float roll_effectiveness = RF_.params_.get_param_float(PARAM_INDI_EFFECTIVENESS_ROLL);
+  float pitch_effectiveness = RF_.params_.get_param_float(PARAM_INDI_EFFECTIVENESS_PITCH);
+  float yaw_effectiveness = RF_.params_.get_param_float(PARAM_INDI_EFFECTIVENESS_YAW);
+  if (!(roll_effectiveness > 0.0f && pitch_effectiveness > 0.0f && yaw_effectiveness > 0.0f))
+  {
+    if (indi_enabled_)
+      RF_.mavlink_.log(Mavlink::LOG_WARNING, "INDI off, effectiveness must be positive");
+    indi_enabled_ = false;
+  }
+  else
+  {
+    indi_inv_effectiveness_.x = 1.0f / roll_effectiveness;
+    indi_inv_effectiveness_.y = 1.0f / pitch_effectiveness;
+    indi_inv_effectiveness_.z = 1.0f / yaw_effectiveness;
+  }
+
+  // The mixer may not be initialized yet, so the projection is built on the first run
+  indi_mixer_ = nullptr;
+  indi_prev_omega_ = RF_.estimator_.state().angular_velocity;
+  indi_omega_dot_ = turbomath::Vector();
+  indi_torque_ = turbomath::Vector();
+}
+
+void Controller::init_indi_effectiveness(const Mixer::mixer_t* mixer)
+{
+  // Fit the outputs to the mixer columns by least squares, so the torque command is recovered
+  // even when the columns are not orthogonal to each other or to the thrust column.  Columns the
+  // mixer does not use are left out of the fit.
+  const float* columns[4] = { mixer->F, mixer->x, mixer->y, mixer->z };
+  float A[4][4] = {{0.0f}};
+  for (uint8_t i = 0; i < Mixer::NUM_OUTPUTS; i++)
+  {
+    if (mixer->output_type[i] == Mixer::NONE)
+      continue;
+    for (uint8_t l = 0; l < 4; l++)
+      for (uint8_t j = 0; j < 4; j++)
+        A[l][j] += columns[l][i]*columns[j][i];
+  }
+  for (uint8_t j = 0; j < 4; j++)
+  {
+    if (A[j][j] == 0.0f)
+      A[j][j] = 1.0f;
+  }
+
+  float inverse[4][4];
+  indi_projection_valid_ = Mixer::invert_4x4(A, inverse);
+  if (indi_projection_valid_)
+  {
+    for (uint8_t l = 0; l < 3; l++)
+      for (uint8_t j = 0; j < 4; j++)
+        indi_projection_[l][j] = inverse[l + 1][j];
+  }
+  else
+  {
+    RF_.mavlink_.log(Mavlink::LOG_WARNING, "INDI off, mixer columns are not independent");
+  }
+  indi_mixer_ = mixer;
+}
+
+void Controller::init_gain_schedule()
+{
+  gain_schedule_enabled_ = RF_.params_.get_param_int(PARAM_GAIN_SCHEDULE);
+
+  // The tables are laid out contiguously in the parameter list, one row of breakpoints
+  // followed by one row of gain multipliers per PID
+  for (uint8_t i = 0; i < GAIN_SCHEDULE_POINTS; i++)
+  {
+    gain_schedule_breakpoints_[i] = RF_.params_.get_param_float(PARAM_GAIN_SCHEDULE_BP_0 + i);
+    for (uint8_t pid = 0; pid < GAIN_SCHEDULE_COUNT; pid++)
+      gain_schedule_[pid][i] = RF_.params_.get_param_float(PARAM_GAIN_SCHEDULE_ROLL_ANGLE_0 + pid*GAIN_SCHEDULE_POINTS + i);
+  }
+}
+
+void Controller::run_gain_schedule()
+{
+  // Schedule on throttle for multirotors and on airspeed for fixedwing
+  float x;
+  if (RF_.params_.get_param_int(PARAM_FIXED_WING))
+    x = RF_.sensors_.data().diff_pressure_velocity;
+  else
+    x = RF_.command_manager_.combined_control().F.value;
+
+  // Find the segment and interpolation fraction once, then apply it to every table
+  // (the schedule is held constant outside of the first and last breakpoints)
+  const float *bp = gain_schedule_breakpoints_;
+  uint8_t i = 0;
+  float frac = 0.0f;
+  if (x >= bp[GAIN_SCHEDULE_POINTS - 1])
+  {
+    i = GAIN_SCHEDULE_POINTS - 2;
+    frac = 1.0f;
+  }
+  else if (x > bp[0])
+  {
+    while (i < GAIN_SCHEDULE_POINTS - 2 && x > bp[i + 1])
+      i++;
+    frac = (x - bp[i]) / (bp[i + 1] - bp[i]);
+  }
+
+  float scale[GAIN_SCHEDULE_COUNT];
+  for (uint8_t pid = 0; pid < GAIN_SCHEDULE_COUNT; pid++)
+    scale[pid] = gain_schedule_[pid][i] + frac * (gain_schedule_[pid][i + 1] - gain_schedule_[pid][i]);
+
+  roll_.set_gain_scale(scale[GAIN_SCHEDULE_ROLL]);
+  roll_rate_.set_gain_scale(scale[GAIN_SCHEDULE_ROLL_RATE]);
+  pitch_.set_gain_scale(scale[GAIN_SCHEDULE_PITCH]);
+  pitch_rate_.set_gain_scale(scale[GAIN_SCHEDULE_PITCH_RATE]);
+  yaw_rate_.set_gain_scale(scale[GAIN_SCHEDULE_YAW_RATE]);
 }
 
 void Controller::run()
@@ -109,18 +238,36 @@ void Controller::run()
     prev_time_us_ = RF_.estimator_.state().timestamp_us;
     return;
   }
+  prev_time_us_ = RF_.estimator_.state().timestamp_us;
 
   // Check if integrators should be updated
   //! @todo better way to figure out if throttle is high
-  bool update_integrators = (RF_.state_manager_.state().armed) && (RF_.command_manager_.combined_control().F.value > 0.1f) && dt_us < 100;
+  // (and not across a gap in the IMU data longer than 10 ms)
+  bool update_integrators = (RF_.state_manager_.state().armed) && (RF_.command_manager_.combined_control().F.value > 0.1f) && dt_us < 10000;
+
+  // Update the active gains from the gain schedule tables
+  if (gain_schedule_enabled_)
+    run_gain_schedule();
 
   // Run the PID loops
   turbomath::Vector pid_output = run_pid_loops(dt_us, RF_.estimator_.state(), RF_.command_manager_.combined_control(), update_integrators);
 
+  turbomath::Vector feedforward(RF_.params_.get_param_float(PARAM_X_EQ_TORQUE),
+                                RF_.params_.get_param_float(PARAM_Y_EQ_TORQUE),
+                                RF_.params_.get_param_float(PARAM_Z_EQ_TORQUE));
+
+  // Turn the PID outputs into increments on the torque actually being produced
+  if (indi_enabled_)
+    run_indi(dt_us, RF_.command_manager_.combined_control(), pid_output, feedforward);
+
+  // Replace the rate loop being tuned with the relay excitation
+  if (autotune_axis_ != AUTOTUNE_NONE)
+    run_autotune(pid_output);
+
   // Add feedforward torques
-  output_.x = pid_output.x + RF_.params_.get_param_float(PARAM_X_EQ_TORQUE);
-  output_.y = pid_output.y + RF_.params_.get_param_float(PARAM_Y_EQ_TORQUE);
-  output_.z = pid_output.z + RF_.params_.get_param_float(PARAM_Z_EQ_TORQUE);
+  output_.x = pid_output.x + feedforward.x;
+  output_.y = pid_output.y + feedforward.y;
+  output_.z = pid_output.z + feedforward.z;
   output_.F = RF_.command_manager_.combined_control().F.value;
 }
 
@@ -168,6 +315,155 @@ void Controller::calculate_equilbrium_torque_from_rc()
   }
 }
 
+bool Controller::start_autotune()
+{
+  if (autotune_axis_ != AUTOTUNE_NONE)
+  {
+    RF_.mavlink_.log(Mavlink::LOG_WARNING, "Autotune already running");
+    return false;
+  }
+
+  if (indi_enabled_)
+  {
+    RF_.mavlink_.log(Mavlink::LOG_WARNING, "Autotune needs the PID rate loops, disable INDI");
+    return false;
+  }
+
+  if (!RF_.state_manager_.state().armed
+      || RF_.params_.get_param_int(PARAM_FIXED_WING)
+      || RF_.command_manager_.combined_control().F.value < 0.1f)
+  {
+    RF_.mavlink_.log(Mavlink::LOG_WARNING, "Autotune requires a multirotor in hover");
+    return false;
+  }
+
+  autotune_axis_ = AUTOTUNE_ROLL;
+  autotune_.start(RF_.params_.get_param_float(PARAM_AUTOTUNE_RELAY),
+                  RF_.params_.get_param_float(PARAM_AUTOTUNE_HYSTERESIS),
+                  RF_.estimator_.state().timestamp_us);
+  RF_.mavlink_.log(Mavlink::LOG_INFO, "Autotuning roll rate");
+  return true;
+}
+
+void Controller::run_autotune(turbomath::Vector& pid_output)
+{
+  const Estimator::State& state = RF_.estimator_.state();
+  const control_t& command = RF_.command_manager_.combined_control();
+
+  // Give control back if we are no longer hovering or the pilot steps in
+  if (!RF_.state_manager_.state().armed || RF_.state_manager_.state().failsafe)
+  {
+    stop_autotune("Autotune aborted, no longer flying");
+    return;
+  }
+  float deviation = RF_.params_.get_param_float(PARAM_RC_OVERRIDE_DEVIATION);
+  if (turbomath::fabs(RF_.rc_.stick(RC::STICK_X)) > deviation
+      || turbomath::fabs(RF_.rc_.stick(RC::STICK_Y)) > deviation
+      || turbomath::fabs(RF_.rc_.stick(RC::STICK_Z)) > deviation)
+  {
+    stop_autotune("Autotune aborted by pilot");
+    return;
+  }
+  // cos(tilt) from the attitude quaternion, abort beyond 45 degrees
+  const turbomath::Quaternion& q = state.attitude;
+  if (1.0f - 2.0f*(q.x*q.x + q.y*q.y) < 0.7071f)
+  {
+    stop_autotune("Autotune aborted, excessive tilt");
+    return;
+  }
+
+  // Oscillate about the commanded rate (or zero if that axis is in angle mode)
+  switch (autotune_axis_)
+  {
+  case AUTOTUNE_ROLL:
+    pid_output.x = autotune_.run(state.timestamp_us,
+                                 state.angular_velocity.x - ((command.x.type == RATE) ? command.x.value : 0.0f));
+    break;
+  case AUTOTUNE_PITCH:
+    pid_output.y = autotune_.run(state.timestamp_us,
+                                 state.angular_velocity.y - ((command.y.type == RATE) ? command.y.value : 0.0f));
+    break;
+  case AUTOTUNE_YAW:
+  default:
+    pid_output.z = autotune_.run(state.timestamp_us,
+                                 state.angular_velocity.z - ((command.z.type == RATE) ? command.z.value : 0.0f));
+    break;
+  }
+
+  if (autotune_.status() == RelayAutotune::DONE)
+    finish_autotune_axis();
+  else if (autotune_.status() == RelayAutotune::FAILED)
+    stop_autotune("Autotune got no oscillation, raise ATUNE_RELAY");
+}
+
+void Controller::finish_autotune_axis()
+{
+  static const uint16_t gain_params[3][3] = {
+    { PARAM_PID_ROLL_RATE_P, PARAM_PID_ROLL_RATE_I, PARAM_PID_ROLL_RATE_D },
+    { PARAM_PID_PITCH_RATE_P, PARAM_PID_PITCH_RATE_I, PARAM_PID_PITCH_RATE_D },
+    { PARAM_PID_YAW_RATE_P, PARAM_PID_YAW_RATE_I, PARAM_PID_YAW_RATE_D }
+  };
+  static const char* axis_names[3] = { "roll", "pitch", "yaw" };
+
+  float ku = autotune_.ultimate_gain();
+  float tu = autotune_.ultimate_period();
+  if (ku <= 0.0f || tu <= 0.0f)
+  {
+    stop_autotune("Autotune failed, oscillation inside hysteresis");
+    return;
+  }
+
+  // Ziegler-Nichols tuning rules from the ultimate gain and period
+  float kp, ki, kd;
+  switch (RF_.params_.get_param_int(PARAM_AUTOTUNE_RULE))
+  {
+  case 0: // classic
+    kp = 0.6f*ku;
+    ki = 1.2f*ku/tu;
+    kd = 0.075f*ku*tu;
+    break;
+  case 2: // PD
+    kp = 0.8f*ku;
+    ki = 0.0f;
+    kd = 0.1f*ku*tu;
+    break;
+  case 1: // no overshoot
+  default:
+    kp = 0.2f*ku;
+    ki = 0.4f*ku/tu;
+    kd = 0.0667f*ku*tu;
+    break;
+  }
+
+  // Each of these re-initializes the controller through the param callback; the relay state
+  // lives outside of init() so it survives
+  uint8_t axis = autotune_axis_;
+  RF_.params_.set_param_float(gain_params[axis][0], kp);
+  RF_.params_.set_param_float(gain_params[axis][1], ki);
+  RF_.params_.set_param_float(gain_params[axis][2], kd);
+  RF_.mavlink_.log(Mavlink::LOG_INFO, "Autotune %s rate gains set", axis_names[axis]);
+
+  if (axis < AUTOTUNE_YAW)
+  {
+    autotune_axis_ = axis + 1;
+    autotune_.start(RF_.params_.get_param_float(PARAM_AUTOTUNE_RELAY),
+                    RF_.params_.get_param_float(PARAM_AUTOTUNE_HYSTERESIS),
+                    RF_.estimator_.state().timestamp_us);
+    RF_.mavlink_.log(Mavlink::LOG_INFO, "Autotuning %s rate", axis_names[autotune_axis_]);
+  }
+  else
+  {
+    autotune_axis_ = AUTOTUNE_NONE;
+    RF_.mavlink_.log(Mavlink::LOG_INFO, "Autotune complete, land and write params to save");
+  }
+}
+
+void Controller::stop_autotune(const char *reason)
+{
+  autotune_axis_ = AUTOTUNE_NONE;
+  RF_.mavlink_.log(Mavlink::LOG_WARNING, "%s", reason);
+}
+
 void Controller::param_change_callback(uint16_t param_id)
 {
   (void) param_id; // suppress unused parameter warning
@@ -179,11 +475,21 @@ turbomath::Vector Controller::run_pid_loops(uint32_t dt_us, const Estimator::Sta
   // Based on the control types coming from the command manager, run the appropriate PID loops
   turbomath::Vector out;
 
-  float dt = dt_us;
+  // The PID gains are per second
+  float dt = 1e-6f*dt_us;
+
+  // In quaternion mode, the angle loops run on the attitude error directly instead of Euler angles
+  bool quaternion_mode = RF_.params_.get_param_int(PARAM_ATT_CONTROL_QUATERNION)
+                         && (command.x.type == ANGLE || command.y.type == ANGLE);
+  turbomath::Vector att_error;
+  if (quaternion_mode)
+    att_error = attitude_error(state, command);
 
   // ROLL
   if (command.x.type == RATE)
     out.x = roll_rate_.run(dt, state.angular_velocity.x, command.x.value, update_integrators);
+  else if (command.x.type == ANGLE && quaternion_mode)
+    out.x = roll_.run(dt, 0.0f, att_error.x, update_integrators, state.angular_velocity.x);
   else if (command.x.type == ANGLE)
     out.x = roll_.run(dt, state.roll, command.x.value, update_integrators, state.angular_velocity.x);
   else
@@ -192,6 +498,8 @@ turbomath::Vector Controller::run_pid_loops(uint32_t dt_us, const Estimator::Sta
   // PITCH
   if (command.y.type == RATE)
     out.y = pitch_rate_.run(dt, state.angular_velocity.y, command.y.value, update_integrators);
+  else if (command.y.type == ANGLE && quaternion_mode)
+    out.y = pitch_.run(dt, 0.0f, att_error.y, update_integrators, state.angular_velocity.y);
   else if (command.y.type == ANGLE)
     out.y = pitch_.run(dt, state.pitch, command.y.value, update_integrators, state.angular_velocity.y);
   else
@@ -206,10 +514,183 @@ turbomath::Vector Controller::run_pid_loops(uint32_t dt_us, const Estimator::Sta
   return out;
 }
 
+void Controller::run_indi(uint32_t dt_us, const control_t& command, turbomath::Vector& torque,
+                          turbomath::Vector& feedforward)
+{
+  const Mixer::mixer_t* mixer = RF_.mixer_.get_mixer();
+  if (mixer != indi_mixer_)
+    init_indi_effectiveness(mixer);
+
+  // Leave the PID output alone if the torque can't be recovered from this mixer's outputs
+  if (!indi_projection_valid_)
+    return;
+
+  // Torque command that the previous (saturated) mixer outputs correspond to, taken before the
+  // thrust curve and battery scaling
+  const float* columns[4] = { mixer->F, mixer->x, mixer->y, mixer->z };
+  const float* u = RF_.mixer_.get_mixed_outputs();
+  float projected[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  for (uint8_t i = 0; i < Mixer::NUM_OUTPUTS; i++)
+  {
+    if (mixer->output_type[i] == Mixer::NONE)
+      continue;
+    for (uint8_t j = 0; j < 4; j++)
+      projected[j] += columns[j][i]*u[i];
+  }
+  turbomath::Vector torque0;
+  for (uint8_t j = 0; j < 4; j++)
+  {
+    torque0.x += indi_projection_[0][j]*projected[j];
+    torque0.y += indi_projection_[1][j]*projected[j];
+    torque0.z += indi_projection_[2][j]*projected[j];
+  }
+
+  // Differentiate the gyro, and pass the actuator feedback through the same filter so that
+  // both signals carry the same delay
+  const turbomath::Vector& omega = RF_.estimator_.state().angular_velocity;
+  if (dt_us > 0)
+  {
+    turbomath::Vector omega_dot = (omega - indi_prev_omega_) / (1e-6f*dt_us);
+    indi_omega_dot_ = indi_alpha_*indi_omega_dot_ + (1.0f - indi_alpha_)*omega_dot;
+    indi_torque_ = indi_alpha_*indi_torque_ + (1.0f - indi_alpha_)*torque0;
+  }
+  indi_prev_omega_ = omega;
+
+  // The PID output, scaled by the effectiveness, is the desired angular acceleration.  The
+  // increment needed to reach it is added to the torque already being produced, which already
+  // includes the equilibrium torques.
+  if (command.x.type != PASSTHROUGH)
+  {
+    torque.x = indi_saturate(indi_torque_.x + torque.x - indi_inv_effectiveness_.x*indi_omega_dot_.x);
+    feedforward.x = 0.0f;
+  }
+  if (command.y.type != PASSTHROUGH)
+  {
+    torque.y = indi_saturate(indi_torque_.y + torque.y - indi_inv_effectiveness_.y*indi_omega_dot_.y);
+    feedforward.y = 0.0f;
+  }
+  if (command.z.type != PASSTHROUGH)
+  {
+    torque.z = indi_saturate(indi_torque_.z + torque.z - indi_inv_effectiveness_.z*indi_omega_dot_.z);
+    feedforward.z = 0.0f;
+  }
+}
+
+turbomath::Vector Controller::attitude_error(const Estimator::State& state, const control_t& command)
+{
+  // Convert the angle command to a down vector only when it changes, so there is no trig in the loop
+  float roll_c = (command.x.type == ANGLE) ? command.x.value : 0.0f;
+  float pitch_c = (command.y.type == ANGLE) ? command.y.value : 0.0f;
+  if (roll_c != roll_command_ || pitch_c != pitch_command_)
+  {
+    roll_command_ = roll_c;
+    pitch_command_ = pitch_c;
+    down_command_ = down_vector(roll_c, pitch_c);
+  }
+  return tilt_error(state.attitude, down_command_);
+}
+
+turbomath::Vector Controller::down_vector(float roll, float pitch)
+{
+  float cos_pitch = turbomath::cos(pitch);
+  return turbomath::Vector(-turbomath::sin(pitch), turbomath::sin(roll)*cos_pitch, turbomath::cos(roll)*cos_pitch);
+}
+
+turbomath::Vector Controller::tilt_error(const turbomath::Quaternion& q, const turbomath::Vector& down_command)
+{
+  // The world down axis in the body frame, from the third row of the rotation matrix.  Like the
+  // command, it depends only on roll and pitch, so heading has no effect on the error.
+  turbomath::Vector down(2.0f*(q.x*q.z - q.w*q.y),
+                         2.0f*(q.y*q.z + q.w*q.x),
+                         1.0f - 2.0f*(q.x*q.x + q.y*q.y));
+
+  // Shortest rotation from the estimated to the commanded down vector.  Scaling the cross product
+  // (sin(theta) times the axis) by 1/cos(theta/2) gives 2*sin(theta/2) times the axis, which is
+  // the vector part of the error quaternion doubled, i.e. the small-angle rotation vector.
+  turbomath::Vector axis = down_command.cross(down);
+  float half_cos_sqrd = 0.5f*(1.0f + down_command.dot(down));
+  if (half_cos_sqrd < 1e-3f)
+    half_cos_sqrd = 1e-3f;
+  return axis * turbomath::inv_sqrt(half_cos_sqrd);
+}
+
+void Controller::RelayAutotune::start(float relay, float hysteresis, uint64_t now_us)
+{
+  status_ = RUNNING;
+  relay_ = relay;
+  hysteresis_ = hysteresis;
+  output_ = relay;
+  max_ = 0.0f;
+  min_ = 0.0f;
+  amplitude_sum_ = 0.0f;
+  period_sum_us_ = 0;
+  last_switch_us_ = now_us;
+  cycles_ = 0;
+}
+
+float Controller::RelayAutotune::run(uint64_t now_us, float error)
+{
+  if (status_ != RUNNING)
+    return 0.0f;
+
+  if (error > max_)
+    max_ = error;
+  if (error < min_)
+    min_ = error;
+
+  // Relay with hysteresis, push against the error
+  if (output_ > 0.0f && error > hysteresis_)
+  {
+    output_ = -relay_;
+  }
+  else if (output_ < 0.0f && error < -hysteresis_)
+  {
+    // Each rising switch closes one period of the limit cycle.  The first few are
+    // discarded while the oscillation settles.
+    output_ = relay_;
+    cycles_++;
+    if (cycles_ > SETTLE_CYCLES)
+    {
+      amplitude_sum_ += 0.5f*(max_ - min_);
+      period_sum_us_ += now_us - last_switch_us_;
+    }
+    if (cycles_ >= SETTLE_CYCLES + MEASURE_CYCLES)
+      status_ = DONE;
+
+    last_switch_us_ = now_us;
+    max_ = error;
+    min_ = error;
+  }
+  else if (now_us - last_switch_us_ > TIMEOUT_US)
+  {
+    status_ = FAILED;
+  }
+
+  return output_;
+}
+
+float Controller::RelayAutotune::ultimate_gain() const
+{
+  // Describing function of a relay with hysteresis: Ku = 4d / (pi*sqrt(a^2 - eps^2))
+  float a = amplitude_sum_ / MEASURE_CYCLES;
+  float den = a*a - hysteresis_*hysteresis_;
+  if (den <= 0.0f)
+    return 0.0f;
+  return 4.0f * relay_ / 3.14159265f * turbomath::inv_sqrt(den);
+}
+
+float Controller::RelayAutotune::ultimate_period() const
+{
+  return 1e-6f * period_sum_us_ / MEASURE_CYCLES;
+}
+
 Controller::PID::PID() :
   kp_(0.0f),
   ki_(0.0f),
   kd_(0.0f),
+  kp_nominal_(0.0f),
+  ki_nominal_(0.0f),
+  kd_nominal_(0.0f),
   max_(1.0f),
   min_(-1.0f),
   integrator_(0.0f),
@@ -223,11 +704,21 @@ void Controller::PID::init(float kp, float ki, float kd, float max, float min, f
   kp_ = kp;
   ki_ = ki;
   kd_ = kd;
+  kp_nominal_ = kp;
+  ki_nominal_ = ki;
+  kd_nominal_ = kd;
   max_ = max;
   min_ = min;
   tau_ = tau;
 }
 
+void Controller::PID::set_gain_scale(float scale)
+{
+  kp_ = kp_nominal_ * scale;
+  ki_ = ki_nominal_ * scale;
+  kd_ = kd_nominal_ * scale;
+}
+
 float Controller::PID::run(float dt, float x, float x_c, bool update_integrator)
 {
   float xdot;
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdint.h>
+
+#include "dshot.h"
+
+namespace rosflight_firmware
+{
+
+// 5-bit GCR symbol to nibble, 0xFF for symbols that are never sent
+static const uint8_t gcr_decode[32] =
+{
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x09, 0x0A, 0x0B, 0xFF, 0x0D, 0x0E, 0x0F,
+  0xFF, 0xFF, 0x02, 0x03, 0xFF, 0x05, 0x06, 0x07,
+  0xFF, 0x00, 0x08, 0x01, 0xFF, 0x04, 0x0C, 0xFF
+};
+
+uint32_t DShot::bitrate(Protocol protocol)
+{
+  switch (protocol)
+  {
+  case PROTOCOL_DSHOT150:
+    return 150000;
+  case PROTOCOL_DSHOT300:
+    return 300000;
+  case PROTOCOL_DSHOT600:
+    return 600000;
+  default:
+    return 0;
+  }
+}
+
+uint16_t DShot::frame(uint16_t value, bool telemetry, bool bidirectional)
+{
+  uint16_t packet = static_cast<uint16_t>(((value & 0x07FF) << 1) | (telemetry ? 1 : 0));
+
+  // XOR of the three nibbles of the packet
+  uint16_t crc = (packet ^ (packet >> 4) ^ (packet >> 8)) & 0x0F;
+  if (bidirectional)
+    crc = ~crc & 0x0F;
+
+  return static_cast<uint16_t>((packet << 4) | crc);
+}
+
+void DShot::encode(uint16_t frame, uint16_t bit_ticks, uint16_t *buffer)
+{
+  // A one is high for 3/4 of the bit period, a zero for 3/8
+  const uint16_t one = static_cast<uint16_t>((3u*bit_ticks) / 4u);
+  const uint16_t zero = static_cast<uint16_t>((3u*bit_ticks) / 8u);
+  for (uint8_t i = 0; i < FRAME_BITS; i++)
+    buffer[i] = (frame & (0x8000 >> i)) ? one : zero;
+  buffer[FRAME_BITS] = 0;
+  buffer[FRAME_BITS + 1] = 0;
+}
+
+bool DShot::decode_telemetry(uint32_t raw, uint32_t *erpm)
+{
+  // Undo the line coding (a transition encodes a one), then map each GCR symbol to a nibble
+  uint32_t gcr = raw ^ (raw >> 1);
+  uint16_t value = 0;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    uint8_t nibble = gcr_decode[(gcr >> (5*i)) & 0x1F];
+    if (nibble > 0x0F)
+      return false;
+    value = static_cast<uint16_t>(value | (nibble << (4*i)));
+  }
+
+  // The checksum nibble is chosen so that all four nibbles XOR to 0xF
+  uint16_t csum = value ^ (value >> 8);
+  csum ^= csum >> 4;
+  if ((csum & 0x0F) != 0x0F)
+    return false;
+
+  // eeem mmmm mmmm: the eRPM period in microseconds as a 9-bit mantissa and 3-bit shift
+  value >>= 4;
+  if (value == 0x0FFF)
+  {
+    *erpm = 0;
+    return true;
+  }
+  uint32_t period_us = static_cast<uint32_t>(value & 0x01FF) << (value >> 9);
+  if (period_us == 0)
+    return false;
+
+  *erpm = 60000000u / period_us;
+  return true;
+}
+
+} // namespace rosflight_firmware
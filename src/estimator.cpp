@@ -248,8 +248,9 @@ void Estimator::run()
     }
   }
 
-  // Extract Euler Angles for controller
-  state_.attitude.get_RPY(&state_.roll, &state_.pitch, &state_.yaw);
+  // Extract Euler Angles for controller (not needed if it is working on the quaternion directly)
+  if (!RF_.params_.get_param_int(PARAM_ATT_CONTROL_QUATERNION))
+    state_.attitude.get_RPY(&state_.roll, &state_.pitch, &state_.yaw);
 
   // Save off adjust gyro measurements with estimated biases for control
   state_.angular_velocity = gyro_LPF_ - bias_;
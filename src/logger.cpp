@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2017, James Jackson and Daniel Koch, BYU MAGICC Lab
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logger.h"
+#include "rosflight.h"
+
+namespace rosflight_firmware
+{
+
+Logger::Logger(ROSflight& rf) :
+  RF_(rf),
+  available_(false),
+  page_used_(0),
+  page_sequence_(0),
+  last_time_us_(0),
+  pages_written_(0),
+  records_dropped_(0),
+  dropped_since_page_(0)
+{
+  for (uint8_t i = 0; i < FIELD_COUNT; i++)
+    last_fields_[i] = 0;
+}
+
+void Logger::init()
+{
+  available_ = BUFFER_PAGES > 0 && RF_.board_.log_init();
+}
+
+int32_t Logger::scale(float value, float scale)
+{
+  float scaled = value * scale;
+  if (scaled > 2e9f)
+    return 2000000000;
+  else if (scaled < -2e9f)
+    return -2000000000;
+  return static_cast<int32_t>(scaled + (scaled > 0.0f ? 0.5f : -0.5f));
+}
+
+uint8_t Logger::put_varint(uint8_t *dst, uint64_t value)
+{
+  // Seven bits at a time, least significant first, with the top bit set on all but the last byte
+  uint8_t length = 0;
+  while (value >= 0x80)
+  {
+    dst[length++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  dst[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+uint16_t Logger::encode(uint8_t *dst, uint64_t time_us, const int32_t *fields, bool key_frame) const
+{
+  uint16_t length = 0;
+  dst[length++] = key_frame ? RECORD_KEY_FRAME : RECORD_DELTA;
+  length += put_varint(&dst[length], key_frame ? time_us : time_us - last_time_us_);
+  for (uint8_t i = 0; i < FIELD_COUNT; i++)
+  {
+    int32_t value = key_frame ? fields[i] : static_cast<int32_t>(static_cast<uint32_t>(fields[i]) -
+                                                                 static_cast<uint32_t>(last_fields_[i]));
+    length += put_varint(&dst[length], zigzag(value));
+  }
+  return length;
+}
+
+void Logger::write_padding(uint16_t length)
+{
+  static const uint8_t zeros[PAGE_SIZE] = {};
+  buffer_.write(zeros, length);
+}
+
+void Logger::record()
+{
+  int32_t mode = RF_.params_.get_param_int(PARAM_BLACKBOX);
+  if (!available_)
+    return;
+  if (mode == LOG_OFF || (mode == LOG_ARMED && !RF_.state_manager_.state().armed))
+  {
+    // Pad out the last page so it gets written too, instead of waiting for the next recording
+    uint16_t padding = static_cast<uint16_t>(PAGE_SIZE - page_used_);
+    if (page_used_ > 0 && buffer_.reserve(padding))
+    {
+      write_padding(padding);
+      buffer_.commit();
+      page_used_ = 0;
+    }
+    return;
+  }
+
+  const Sensors::Data &sensors = RF_.sensors_.data();
+  const turbomath::Quaternion &attitude = RF_.estimator_.state().attitude;
+  const Controller::Output &control = RF_.controller_.output();
+  const float *outputs = RF_.mixer_.get_outputs();
+  int32_t fields[FIELD_COUNT] =
+  {
+    scale(sensors.accel.x, 1e3f), scale(sensors.accel.y, 1e3f), scale(sensors.accel.z, 1e3f),
+    scale(sensors.gyro.x, 1e4f), scale(sensors.gyro.y, 1e4f), scale(sensors.gyro.z, 1e4f),
+    scale(attitude.w, 1e4f), scale(attitude.x, 1e4f), scale(attitude.y, 1e4f), scale(attitude.z, 1e4f),
+    scale(control.F, 1e4f), scale(control.x, 1e4f), scale(control.y, 1e4f), scale(control.z, 1e4f)
+  };
+  for (uint8_t i = 0; i < Mixer::NUM_OUTPUTS; i++)
+    fields[FIELD_OUTPUTS + i] = scale(outputs[i], 1e4f);
+
+  // A record that doesn't fit in the rest of the page pads it out and starts the next one
+  uint8_t record[MAX_RECORD_LEN];
+  bool key_frame = (page_used_ == 0);
+  uint16_t length = encode(record, sensors.imu_time, fields, key_frame);
+  uint16_t padding = 0;
+  if (!key_frame && page_used_ + length > PAGE_SIZE)
+  {
+    padding = static_cast<uint16_t>(PAGE_SIZE - page_used_);
+    key_frame = true;
+    length = encode(record, sensors.imu_time, fields, key_frame);
+  }
+
+  // The control loop never waits on the log, a record that doesn't fit is dropped and counted
+  if (!buffer_.reserve(static_cast<uint16_t>(padding + (key_frame ? PAGE_HEADER_LEN : 0) + length)))
+  {
+    records_dropped_++;
+    dropped_since_page_++;
+    return;
+  }
+  write_padding(padding);
+  if (key_frame)
+  {
+    uint8_t header[PAGE_HEADER_LEN] = { PAGE_MAGIC, FORMAT_VERSION,
+                                        static_cast<uint8_t>(page_sequence_ & 0xFF),
+                                        static_cast<uint8_t>(page_sequence_ >> 8), Mixer::NUM_OUTPUTS,
+                                        static_cast<uint8_t>(dropped_since_page_ & 0xFF),
+                                        static_cast<uint8_t>(dropped_since_page_ >> 8) };
+    buffer_.write(header, PAGE_HEADER_LEN);
+    page_sequence_++;
+    page_used_ = PAGE_HEADER_LEN;
+    dropped_since_page_ = 0;
+  }
+  buffer_.write(record, length);
+  buffer_.commit();
+  page_used_ = static_cast<uint16_t>(page_used_ + length);
+
+  last_time_us_ = sensors.imu_time;
+  for (uint8_t i = 0; i < FIELD_COUNT; i++)
+    last_fields_[i] = fields[i];
+}
+
+void Logger::run()
+{
+  // One page per call, since programming a page of flash can take a millisecond.  A partly filled
+  // page waits for the next record that doesn't fit in it.
+  if (!available_ || buffer_.size() < PAGE_SIZE)
+    return;
+
+  uint16_t length;
+  const uint8_t *page = buffer_.peek(&length);
+  if (RF_.board_.log_write(page, PAGE_SIZE))
+  {
+    pages_written_++;
+  }
+  else
+  {
+    available_ = false;
+    RF_.mavlink_.log(Mavlink::LOG_WARNING, "Blackbox log full, stopped recording");
+  }
+  buffer_.pop(PAGE_SIZE);
+}
+
+} // namespace rosflight_firmware
@@ -33,12 +33,78 @@
 #include "mavlink.h"
 #include "rosflight.h"
 
+// The MAVLink send functions take the header ids from here
+mavlink_system_t mavlink_system;
+
 namespace rosflight_firmware {
 
+// The link the MAVLink send hooks write to.  The library only has the one set of ids, so there
+// is only ever one link.
+static Mavlink *tx_link = nullptr;
+
+// MAVLink 2 framing needs each message's CRC_EXTRA, which the library's send hooks don't see
+static uint8_t mavlink_crc_extra(uint32_t msgid)
+{
+  static const uint8_t crcs[256] = MAVLINK_MESSAGE_CRCS;
+  switch (msgid)
+  {
+  case MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH:
+    return MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_CRC;
+  case MAVLINK_MSG_ID_ROSFLIGHT_LOG:
+    return MAVLINK_MSG_ID_ROSFLIGHT_LOG_CRC;
+  case MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST:
+    return MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_CRC;
+  case MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK:
+    return MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_CRC;
+  default:
+    return (msgid < 256) ? crcs[msgid] : 0;
+  }
+}
+
+void mavlink_tx_start(uint16_t length)
+{
+  if (tx_link)
+    tx_link->tx_start(length);
+}
+
+void mavlink_tx_bytes(const uint8_t *data, uint16_t length)
+{
+  if (tx_link)
+    tx_link->tx_bytes(data, length);
+}
+
+void mavlink_tx_end(void)
+{
+  if (tx_link)
+    tx_link->tx_end();
+}
+
 Mavlink::Mavlink(ROSflight& _rf) :
   RF_(_rf)
 {
   initialized_ = false;
+  tx_dropped_messages_ = 0;
+  tx_dropped_reported_ = 0;
+  rx_budget_overruns_ = 0;
+  log_head_ = 0;
+  log_tail_ = 0;
+  log_dropped_ = 0;
+  param_blob_offset_ = 0;
+  param_blob_length_ = 0;
+  param_blob_names_ = false;
+  rx_budget_overruns_reported_ = 0;
+  tx_dropping_ = false;
+  tx_offset_ = 0;
+  mavlink2_ = false;
+  rx2_index_ = 0;
+  tx_bytes_queued_ = 0;
+  tx_bytes_charged_ = 0;
+}
+
+Mavlink::~Mavlink()
+{
+  if (tx_link == this)
+    tx_link = nullptr;
 }
 
 // function definitions
@@ -46,13 +112,33 @@ void Mavlink::init()
 {
   RF_.board_.serial_init(RF_.params_.get_param_int(PARAM_BAUD_RATE));
 
-  sysid_ = RF_.params_.get_param_int(PARAM_SYSTEM_ID);
+  // 10 bits on the wire per byte (8N1)
+  link_bytes_per_us_ = LINK_USABLE_FRACTION * RF_.params_.get_param_int(PARAM_BAUD_RATE) / 10.0f / 1e6f;
+  tx_budget_bytes_ = 0.0f;
+  last_stream_time_us_ = RF_.board_.clock_micros();
+  rate_window_start_us_ = last_stream_time_us_;
+  next_stream_ = 0;
+  imu_samples_seen_ = RF_.sensors_.imu_sample_count();
+  imu_samples_window_start_ = imu_samples_seen_;
+  imu_decimation_ = 1;
+
   compid_ = 250;
+  set_system_id(PARAM_SYSTEM_ID);
+  set_mavlink_version(PARAM_MAVLINK_VERSION);
+  tx_link = this;
 
   offboard_control_time_ = 0;
+  timesync_pending_ = false;
+  timesync_samples_ = 0;
+  timesync_rtt_us_ = 0;
+  host_offset_ns_ = 0;
+  host_skew_ = 0.0f;
+  timesync_ref_us_ = 0;
   send_params_index_ = PARAMS_COUNT;
 
   // Register Param change callbacks
+  RF_.params_.add_callback(std::bind(&Mavlink::set_system_id, this, std::placeholders::_1), PARAM_SYSTEM_ID);
+  RF_.params_.add_callback(std::bind(&Mavlink::set_mavlink_version, this, std::placeholders::_1), PARAM_MAVLINK_VERSION);
   RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_HEARTBEAT, std::placeholders::_1), PARAM_STREAM_HEARTBEAT_RATE);
   RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_ATTITUDE, std::placeholders::_1), PARAM_STREAM_ATTITUDE_RATE);
   RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_IMU, std::placeholders::_1), PARAM_STREAM_IMU_RATE);
@@ -63,18 +149,188 @@ void Mavlink::init()
   RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_MAG, std::placeholders::_1), PARAM_STREAM_MAG_RATE);
   RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_SERVO_OUTPUT_RAW, std::placeholders::_1), PARAM_STREAM_OUTPUT_RAW_RATE);
   RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_RC_RAW, std::placeholders::_1), PARAM_STREAM_RC_RAW_RATE);
+  RF_.params_.add_callback(std::bind(&Mavlink::set_streaming_rate, this, STREAM_ID_TIMESYNC, std::placeholders::_1), PARAM_STREAM_TIMESYNC_RATE);
 
   initialized_ = true;
   log(Mavlink::LOG_INFO, "Booting");
 }
 
-void Mavlink::send_message(const mavlink_message_t &msg)
+void Mavlink::set_system_id(int16_t param_id)
+{
+  sysid_ = RF_.params_.get_param_int(param_id);
+  mavlink_system.sysid = static_cast<uint8_t>(sysid_);
+  mavlink_system.compid = static_cast<uint8_t>(compid_);
+}
+
+void Mavlink::set_mavlink_version(int16_t param_id)
+{
+  // Automatic starts out on MAVLink 1 and switches once a MAVLink 2 frame is received
+  mavlink2_ = RF_.params_.get_param_int(param_id) == MAVLINK_VERSION_2;
+}
+
+void Mavlink::tx_start(uint16_t length)
+{
+  // A message that doesn't fit is dropped whole, so the receiver never sees part of one.  A
+  // MAVLink 2 frame is up to 4 bytes longer than the MAVLink 1 frame the library is sending.
+  uint16_t frame_length = mavlink2_ ? static_cast<uint16_t>(length - MAVLINK_NUM_NON_PAYLOAD_BYTES + MAVLINK2_HEADER_LEN +
+                                                            MAVLINK_NUM_CHECKSUM_BYTES) : length;
+  tx_offset_ = 0;
+  tx_dropping_ = !initialized_ || !tx_buffer_.reserve(frame_length);
+  if (initialized_ && tx_dropping_)
+  {
+    tx_bytes_queued_ += frame_length;
+    tx_dropped_messages_++;
+  }
+}
+
+void Mavlink::tx_bytes(const uint8_t *bytes, uint16_t length)
+{
+  if (tx_dropping_)
+    return;
+
+  if (!mavlink2_)
+  {
+    tx_buffer_.write(bytes, length);
+    tx_bytes_queued_ += length;
+    return;
+  }
+
+  // The library hands over the header, the payload and the checksum in separate calls.  The
+  // header is held until the payload shows how much of it has to be sent, and the MAVLink 1
+  // checksum is left out.
+  if (tx_offset_ < MAVLINK_NUM_HEADER_BYTES)
+  {
+    for (uint16_t i = 0; i < length && tx_offset_ + i < MAVLINK_NUM_HEADER_BYTES; i++)
+      tx_header_[tx_offset_ + i] = bytes[i];
+  }
+  else if (tx_offset_ == MAVLINK_NUM_HEADER_BYTES)
+  {
+    if (length == tx_header_[1])
+    {
+      write_mavlink2_frame(bytes, tx_header_[1]);
+    }
+    else
+    {
+      tx_dropping_ = true;
+      tx_dropped_messages_++;
+    }
+  }
+  tx_offset_ = static_cast<uint16_t>(tx_offset_ + length);
+}
+
+void Mavlink::tx_end(void)
+{
+  if (!tx_dropping_)
+  {
+    tx_buffer_.commit();
+    flush_tx();
+  }
+}
+
+void Mavlink::write_mavlink2_frame(const uint8_t *payload, uint8_t length)
+{
+  // Trailing zeros are left off and filled back in by the receiver, but the first byte is always sent
+  uint8_t payload_length = length;
+  while (payload_length > 1 && payload[payload_length - 1] == 0)
+    payload_length--;
+
+  uint8_t header[MAVLINK2_HEADER_LEN] = { MAVLINK2_STX, payload_length, 0, 0, tx_header_[2], tx_header_[3],
+                                          tx_header_[4], tx_header_[5], 0, 0 };
+  uint16_t checksum;
+  crc_init(&checksum);
+  crc_accumulate_buffer(&checksum, reinterpret_cast<const char *>(&header[1]), MAVLINK2_HEADER_LEN - 1);
+  crc_accumulate_buffer(&checksum, reinterpret_cast<const char *>(payload), payload_length);
+  crc_accumulate(mavlink_crc_extra(tx_header_[5]), &checksum);
+  uint8_t ck[MAVLINK_NUM_CHECKSUM_BYTES] = { static_cast<uint8_t>(checksum & 0xFF), static_cast<uint8_t>(checksum >> 8) };
+
+  tx_buffer_.write(header, MAVLINK2_HEADER_LEN);
+  tx_buffer_.write(payload, payload_length);
+  tx_buffer_.write(ck, MAVLINK_NUM_CHECKSUM_BYTES);
+  tx_bytes_queued_ += MAVLINK2_HEADER_LEN + payload_length + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+void Mavlink::parse_mavlink2_char(uint8_t c)
+{
+  if (rx2_index_ == 0)
+  {
+    if (c == MAVLINK2_STX)
+    {
+      crc_init(&rx2_crc_);
+      rx2_index_ = 1;
+    }
+    return;
+  }
+
+  uint8_t length = rx2_header_[1];
+  uint16_t payload_end = static_cast<uint16_t>(MAVLINK2_HEADER_LEN + length);
+  uint8_t *payload = reinterpret_cast<uint8_t *>(rx2_msg_.payload64);
+  if (rx2_index_ < MAVLINK2_HEADER_LEN)
+  {
+    rx2_header_[rx2_index_] = c;
+    crc_accumulate(c, &rx2_crc_);
+
+    // Signed frames are accepted without checking the signature, anything else is unknown
+    if (rx2_index_ == 2 && (c & ~MAVLINK2_IFLAG_SIGNED))
+    {
+      rx2_index_ = 0;
+      return;
+    }
+  }
+  else if (rx2_index_ < payload_end)
+  {
+    payload[rx2_index_ - MAVLINK2_HEADER_LEN] = c;
+    crc_accumulate(c, &rx2_crc_);
+  }
+  else
+  {
+    uint32_t msgid = rx2_header_[7] | (rx2_header_[8] << 8) | (static_cast<uint32_t>(rx2_header_[9]) << 16);
+    uint16_t trailer_index = static_cast<uint16_t>(rx2_index_ - payload_end);
+    if (trailer_index == 0)
+      crc_accumulate(mavlink_crc_extra(msgid), &rx2_crc_);
+    if ((trailer_index == 0 && c != (rx2_crc_ & 0xFF)) || (trailer_index == 1 && c != (rx2_crc_ >> 8)))
+    {
+      rx2_index_ = 0;
+      return;
+    }
+
+    uint16_t trailer_last = (rx2_header_[2] & MAVLINK2_IFLAG_SIGNED) ?
+                            MAVLINK_NUM_CHECKSUM_BYTES + MAVLINK2_SIGNATURE_LEN - 1 : MAVLINK_NUM_CHECKSUM_BYTES - 1;
+    if (trailer_index == trailer_last)
+    {
+      rx2_index_ = 0;
+      if (RF_.params_.get_param_int(PARAM_MAVLINK_VERSION) == MAVLINK_VERSION_AUTO)
+        mavlink2_ = true;
+
+      // The handlers use the MAVLink 1 message layout, which only has room for 8-bit ids
+      if (msgid < 256)
+      {
+        memset(&payload[length], 0, MAVLINK_MAX_PAYLOAD_LEN - length);
+        rx2_msg_.magic = MAVLINK2_STX;
+        rx2_msg_.len = length;
+        rx2_msg_.seq = rx2_header_[4];
+        rx2_msg_.sysid = rx2_header_[5];
+        rx2_msg_.compid = rx2_header_[6];
+        rx2_msg_.msgid = static_cast<uint8_t>(msgid);
+        handle_mavlink_message(&rx2_msg_);
+      }
+      return;
+    }
+  }
+  rx2_index_++;
+}
+
+void Mavlink::flush_tx(void)
 {
-  if (initialized_)
+  // Hand the board as much as it will take without waiting, the buffer can wrap so this may
+  // take two writes
+  while (!tx_buffer_.empty())
   {
-    uint8_t data[MAVLINK_MAX_PACKET_LEN];
-    uint16_t len = mavlink_msg_to_send_buffer(data, &msg);
-    RF_.board_.serial_write(data, len);
+    uint16_t len;
+    const uint8_t *data = tx_buffer_.peek(&len);
+    size_t written = RF_.board_.serial_write_nonblocking(data, len);
+    tx_buffer_.pop(static_cast<uint16_t>(written));
+    if (written < len)
+      break;
   }
 }
 
@@ -101,10 +357,8 @@ void Mavlink::update_param(uint16_t param_id)
       return;
     }
 
-    mavlink_message_t msg;
-    mavlink_msg_param_value_pack(RF_.params_.get_param_int(PARAM_SYSTEM_ID), 0, &msg,
+    mavlink_msg_param_value_send(MAVLINK_COMM_0,
                                  RF_.params_.get_param_name(param_id), RF_.params_.get_param_float(param_id), type, PARAMS_COUNT, param_id);
-    send_message(msg);
   }
 }
 
@@ -177,6 +431,96 @@ void Mavlink::send_next_param(void)
   }
 }
 
+void Mavlink::handle_msg_rosflight_param_bulk_request(const mavlink_message_t *const msg)
+{
+  mavlink_rosflight_param_bulk_request_t request;
+  mavlink_msg_rosflight_param_bulk_request_decode(msg, &request);
+
+  if (request.target_system == static_cast<uint8_t>(RF_.params_.get_param_int(PARAM_SYSTEM_ID)))
+  {
+    // Names and types only have to be sent when the client's cached table doesn't match ours
+    param_blob_names_ = request.table_hash != RF_.params_.get_table_hash();
+    param_blob_length_ = static_cast<uint16_t>(PARAM_BLOB_HEADER_LEN + 4*PARAMS_COUNT +
+                                               (param_blob_names_ ? (Params::PARAMS_NAME_LENGTH + 1)*PARAMS_COUNT : 0));
+    param_blob_offset_ = 0;
+  }
+}
+
+void Mavlink::send_next_param_chunk(void)
+{
+  uint8_t data[MAVLINK_MSG_ROSFLIGHT_PARAM_CHUNK_FIELD_DATA_LEN] = {};
+  uint16_t length = static_cast<uint16_t>(param_blob_length_ - param_blob_offset_);
+  if (length > MAVLINK_MSG_ROSFLIGHT_PARAM_CHUNK_FIELD_DATA_LEN)
+    length = MAVLINK_MSG_ROSFLIGHT_PARAM_CHUNK_FIELD_DATA_LEN;
+  fill_param_blob(data, param_blob_offset_, static_cast<uint8_t>(length));
+
+  mavlink_msg_rosflight_param_chunk_send(MAVLINK_COMM_0, RF_.params_.get_table_hash(), param_blob_length_,
+                                         param_blob_offset_, crc_calculate(data, length), static_cast<uint8_t>(length),
+                                         data);
+
+  param_blob_offset_ = static_cast<uint16_t>(param_blob_offset_ + length);
+  if (param_blob_offset_ >= param_blob_length_)
+    param_blob_length_ = 0;
+}
+
+void Mavlink::fill_param_blob(uint8_t *dst, uint16_t offset, uint8_t length)
+{
+  uint32_t hash = RF_.params_.get_table_hash();
+  const uint8_t header[PARAM_BLOB_HEADER_LEN] = { static_cast<uint8_t>(hash), static_cast<uint8_t>(hash >> 8),
+                                                  static_cast<uint8_t>(hash >> 16), static_cast<uint8_t>(hash >> 24),
+                                                  static_cast<uint8_t>(PARAMS_COUNT & 0xFF),
+                                                  static_cast<uint8_t>(PARAMS_COUNT >> 8),
+                                                  static_cast<uint8_t>(param_blob_names_ ? PARAM_BLOB_FLAG_NAMES : 0) };
+
+  // Each byte is worked out from its place in the blob, so the blob never has to be in memory
+  for (uint8_t i = 0; i < length; i++)
+  {
+    uint16_t index = static_cast<uint16_t>(offset + i);
+    if (index < PARAM_BLOB_HEADER_LEN)
+    {
+      dst[i] = header[index];
+      continue;
+    }
+
+    index = static_cast<uint16_t>(index - PARAM_BLOB_HEADER_LEN);
+    if (index < 4*PARAMS_COUNT)
+    {
+      uint32_t value = static_cast<uint32_t>(RF_.params_.get_param_int(index / 4));
+      dst[i] = static_cast<uint8_t>(value >> (8*(index % 4)));
+      continue;
+    }
+
+    index = static_cast<uint16_t>(index - 4*PARAMS_COUNT);
+    if (index < Params::PARAMS_NAME_LENGTH*PARAMS_COUNT)
+    {
+      // Zero-padded after the terminator
+      const char *name = RF_.params_.get_param_name(index / Params::PARAMS_NAME_LENGTH);
+      uint8_t j = static_cast<uint8_t>(index % Params::PARAMS_NAME_LENGTH);
+      dst[i] = static_cast<uint8_t>(name[j]);
+      for (uint8_t k = 0; k < j; k++)
+      {
+        if (name[k] == '\0')
+          dst[i] = 0;
+      }
+      continue;
+    }
+
+    index = static_cast<uint16_t>(index - Params::PARAMS_NAME_LENGTH*PARAMS_COUNT);
+    switch (RF_.params_.get_param_type(index))
+    {
+    case PARAM_TYPE_INT32:
+      dst[i] = MAV_PARAM_TYPE_INT32;
+      break;
+    case PARAM_TYPE_FLOAT:
+      dst[i] = MAV_PARAM_TYPE_REAL32;
+      break;
+    default:
+      dst[i] = 0;
+      break;
+    }
+  }
+}
+
 
 void Mavlink::handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
 {
@@ -187,8 +531,13 @@ void Mavlink::handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
   bool reboot_flag = false;
   bool reboot_to_bootloader_flag = false;
 
+  // The autotuner is the one command that has to run in flight
+  if (cmd.command == ROSFLIGHT_CMD_AUTOTUNE)
+  {
+    result = RF_.controller_.start_autotune();
+  }
   // None of these actions can be performed if we are armed
-  if (RF_.state_manager_.state().armed)
+  else if (RF_.state_manager_.state().armed)
   {
     result = false;
   }
@@ -228,9 +577,7 @@ void Mavlink::handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
       reboot_to_bootloader_flag = true;
       break;
     case ROSFLIGHT_CMD_SEND_VERSION:
-      mavlink_message_t out_msg;
-      mavlink_msg_rosflight_version_pack(sysid_, compid_, &out_msg, GIT_VERSION_STRING);
-      send_message(out_msg);
+      mavlink_msg_rosflight_version_send(MAVLINK_COMM_0, GIT_VERSION_STRING);
       break;
     default:
       log(LOG_ERROR, "Unsupported ROSFLIGHT CMD %d", cmd.command);
@@ -241,9 +588,7 @@ void Mavlink::handle_msg_rosflight_cmd(const mavlink_message_t *const msg)
 
   uint8_t response = (result) ? ROSFLIGHT_CMD_SUCCESS : ROSFLIGHT_CMD_FAILED;
 
-  mavlink_message_t ack_msg;
-  mavlink_msg_rosflight_cmd_ack_pack(sysid_, compid_, &ack_msg, cmd.command, response);
-  send_message(ack_msg);
+  mavlink_msg_rosflight_cmd_ack_send(MAVLINK_COMM_0, cmd.command, response);
 
   if (reboot_flag || reboot_to_bootloader_flag)
   {
@@ -261,10 +606,75 @@ void Mavlink::handle_msg_timesync(const mavlink_message_t *const msg)
 
   if (tsync.tc1 == 0) // check that this is a request, not a response
   {
-    mavlink_message_t out_msg;
-    mavlink_msg_timesync_pack(sysid_, compid_, &out_msg, static_cast<int64_t>(now_us)*1000, tsync.ts1);
-    send_message(out_msg);
+    mavlink_msg_timesync_send(MAVLINK_COMM_0, static_cast<int64_t>(now_us)*1000, tsync.ts1);
+  }
+  else if (timesync_pending_ && tsync.ts1 == static_cast<int64_t>(timesync_request_us_)*1000)
+  {
+    timesync_pending_ = false;
+    update_host_clock(now_us, tsync.tc1);
+  }
+}
+
+void Mavlink::update_host_clock(uint64_t now_us, int64_t host_ns)
+{
+  uint32_t rtt_us = static_cast<uint32_t>(now_us - timesync_request_us_);
+  int64_t sample_ns = host_ns - static_cast<int64_t>(timesync_request_us_ + rtt_us/2)*1000;
+
+  // An answer that took much longer than the typical round trip has an unknown split between the
+  // two directions.  It still nudges the typical round trip up, so that is recovered if the link
+  // gets slower for good.
+  uint32_t max_rtt_us = 2*timesync_rtt_us_ + TIMESYNC_RTT_MARGIN_US;
+  bool outlier = timesync_samples_ > 0 && rtt_us > max_rtt_us;
+  if (timesync_samples_ == 0)
+    timesync_rtt_us_ = rtt_us;
+  else if (outlier)
+    timesync_rtt_us_ += (max_rtt_us - timesync_rtt_us_)/64;
+  else
+    timesync_rtt_us_ = static_cast<uint32_t>(timesync_rtt_us_ + (static_cast<int64_t>(rtt_us) - timesync_rtt_us_)/8);
+  if (outlier)
+    return;
+
+  if (timesync_samples_ > 0)
+  {
+    float dt_us = static_cast<float>(now_us - timesync_ref_us_);
+    int64_t predicted_ns = host_offset_ns_ + static_cast<int64_t>(host_skew_ * dt_us * 1000.0f);
+    int64_t residual_ns = sample_ns - predicted_ns;
+    if (residual_ns > TIMESYNC_RESET_NS || residual_ns < -TIMESYNC_RESET_NS)
+    {
+      timesync_samples_ = 0;
+    }
+    else
+    {
+      host_offset_ns_ = predicted_ns + static_cast<int64_t>(TIMESYNC_ALPHA * residual_ns);
+      host_skew_ += TIMESYNC_BETA * residual_ns / (dt_us * 1000.0f);
+      if (host_skew_ > TIMESYNC_MAX_SKEW)
+        host_skew_ = TIMESYNC_MAX_SKEW;
+      else if (host_skew_ < -TIMESYNC_MAX_SKEW)
+        host_skew_ = -TIMESYNC_MAX_SKEW;
+    }
+  }
+  if (timesync_samples_ == 0)
+  {
+    host_offset_ns_ = sample_ns;
+    host_skew_ = 0.0f;
   }
+  timesync_ref_us_ = now_us;
+  if (timesync_samples_ < TIMESYNC_MIN_SAMPLES)
+    timesync_samples_++;
+}
+
+uint64_t Mavlink::host_time_us(uint64_t time_us) const
+{
+  float dt_us = static_cast<float>(static_cast<int64_t>(time_us - timesync_ref_us_));
+  int64_t offset_ns = host_offset_ns_ + static_cast<int64_t>(host_skew_ * dt_us * 1000.0f);
+  return static_cast<uint64_t>(static_cast<int64_t>(time_us) + offset_ns/1000);
+}
+
+uint64_t Mavlink::stamp_us(uint64_t time_us) const
+{
+  if (host_time_valid() && RF_.params_.get_param_int(PARAM_TIMESYNC_STAMP))
+    return host_time_us(time_us);
+  return time_us;
 }
 
 void Mavlink::handle_msg_offboard_control(const mavlink_message_t *const msg)
@@ -312,31 +722,37 @@ void Mavlink::handle_msg_offboard_control(const mavlink_message_t *const msg)
   }
 
   // Tell the command_manager that we have a new command we need to mux
-  new_offboard_command.stamp_ms = RF_.board_.clock_millis();
+  // Stamped with when it was sent, as far as the round trip to the onboard computer tells
+  uint32_t latency_ms = host_time_valid() ? (timesync_rtt_us_/2 + 500)/1000 : 0;
+  uint32_t now_ms = RF_.board_.clock_millis();
+  new_offboard_command.stamp_ms = (now_ms > latency_ms) ? now_ms - latency_ms : 0;
   RF_.command_manager_.set_new_offboard_command(new_offboard_command);
 }
 
-void Mavlink::handle_mavlink_message(void)
+void Mavlink::handle_mavlink_message(const mavlink_message_t *const msg)
 {
-  switch (in_buf_.msgid)
+  switch (msg->msgid)
   {
   case MAVLINK_MSG_ID_OFFBOARD_CONTROL:
-    handle_msg_offboard_control(&in_buf_);
+    handle_msg_offboard_control(msg);
     break;
   case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
     handle_msg_param_request_list();
     break;
   case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
-    handle_msg_param_request_read(&in_buf_);
+    handle_msg_param_request_read(msg);
     break;
   case MAVLINK_MSG_ID_PARAM_SET:
-    handle_msg_param_set(&in_buf_);
+    handle_msg_param_set(msg);
+    break;
+  case MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST:
+    handle_msg_rosflight_param_bulk_request(msg);
     break;
   case MAVLINK_MSG_ID_ROSFLIGHT_CMD:
-    handle_msg_rosflight_cmd(&in_buf_);
+    handle_msg_rosflight_cmd(msg);
     break;
   case MAVLINK_MSG_ID_TIMESYNC:
-    handle_msg_timesync(&in_buf_);
+    handle_msg_timesync(msg);
     break;
   default:
     break;
@@ -346,41 +762,165 @@ void Mavlink::handle_mavlink_message(void)
 // function definitions
 void Mavlink::receive(void)
 {
-  while (RF_.board_.serial_bytes_available())
+  uint64_t start_us = RF_.board_.clock_micros();
+  uint16_t budget_bytes = RX_BUDGET_BYTES;
+  while (budget_bytes > 0)
   {
-    if (mavlink_parse_char(MAVLINK_COMM_0, RF_.board_.serial_read(), &in_buf_, &status_))
-      handle_mavlink_message();
+    uint8_t data[RX_CHUNK_BYTES];
+    uint16_t chunk_bytes = RX_CHUNK_BYTES;
+    if (budget_bytes < chunk_bytes)
+      chunk_bytes = budget_bytes;
+    size_t len = RF_.board_.serial_read(data, chunk_bytes);
+    if (len == 0)
+      return;
+
+    for (size_t i = 0; i < len; i++)
+    {
+      if (mavlink_parse_char(MAVLINK_COMM_0, data[i], &in_buf_, &status_))
+        handle_mavlink_message(&in_buf_);
+      parse_mavlink2_char(data[i]);
+    }
+    budget_bytes = static_cast<uint16_t>(budget_bytes - len);
+
+    if (RF_.board_.clock_micros() - start_us > RX_BUDGET_US)
+      break;
   }
+
+  if (RF_.board_.serial_bytes_available())
+    rx_budget_overruns_++;
+}
+
+// The id the host looks a format string up by in the dictionary made by log_dictionary.py
+static uint32_t log_format_id(const char *fmt)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *c = fmt; *c != '\0'; c++)
+    hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+  return hash;
+}
+
+static void format_log_arg(char *dst, const char *spec, ...)
+{
+  va_list args;
+  va_start(args, spec);
+  rosflight_firmware::nanoprintf::tfp_sprintf(dst, spec, args);
+  va_end(args);
 }
 
 void Mavlink::log(uint8_t severity, const char *fmt, ...)
 {
-  // Convert the format string to a raw char array
+  if (!initialized_)
+    return;
+
+  uint8_t next = static_cast<uint8_t>((log_head_ + 1) % LOG_QUEUE_LENGTH);
+  if (next == log_tail_)
+  {
+    log_dropped_++;
+    return;
+  }
+
+  log_entry_t &entry = log_queue_[log_head_];
+  entry.fmt = fmt;
+  entry.severity = severity;
+  entry.has_strings = false;
+
+  // Take the arguments in the types the conversions will read them as
   va_list args;
   va_start(args, fmt);
-  char text[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN];
-  rosflight_firmware::nanoprintf::tfp_sprintf(text, fmt, args);
+  uint8_t num_args = 0;
+  for (const char *c = fmt; *c != '\0' && num_args < LOG_MAX_ARGS; c++)
+  {
+    if (*c != '%')
+      continue;
+    while (c[1] >= '0' && c[1] <= '9')
+      c++;
+    if (c[1] == 's')
+    {
+      entry.args[num_args++].string = va_arg(args, const char *);
+      entry.has_strings = true;
+    }
+    else if (c[1] == 'd' || c[1] == 'u' || c[1] == 'x' || c[1] == 'X' || c[1] == 'c')
+    {
+      entry.args[num_args++].value = va_arg(args, unsigned int);
+    }
+    if (c[1] != '\0')
+      c++;
+  }
   va_end(args);
-  send_log_message(severity, text);
+  for (uint8_t i = num_args; i < LOG_MAX_ARGS; i++)
+    entry.args[i].value = 0;
+
+  log_head_ = next;
+}
+
+void Mavlink::send_next_log(void)
+{
+  const log_entry_t &entry = log_queue_[log_tail_];
+  if (RF_.params_.get_param_int(PARAM_LOG_BINARY) && !entry.has_strings)
+  {
+    uint8_t args[MAVLINK_MSG_ROSFLIGHT_LOG_FIELD_ARGS_LEN];
+    for (uint8_t i = 0; i < LOG_MAX_ARGS; i++)
+    {
+      for (uint8_t j = 0; j < 4; j++)
+        args[4*i + j] = static_cast<uint8_t>(entry.args[i].value >> (8*j));
+    }
+    mavlink_msg_rosflight_log_send(MAVLINK_COMM_0, log_format_id(entry.fmt), entry.severity, args);
+  }
+  else
+  {
+    char text[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN];
+    format_log(entry, text, sizeof(text));
+    send_log_message(entry.severity, text);
+  }
+  log_tail_ = static_cast<uint8_t>((log_tail_ + 1) % LOG_QUEUE_LENGTH);
+}
+
+void Mavlink::format_log(const log_entry_t &entry, char *text, uint8_t size)
+{
+  // Each conversion is formatted on its own, since the arguments can't be passed on as a va_list
+  uint8_t length = 0;
+  uint8_t arg = 0;
+  for (const char *c = entry.fmt; *c != '\0' && length + 1 < size; c++)
+  {
+    if (*c != '%' || c[1] == '\0')
+    {
+      text[length++] = *c;
+      continue;
+    }
+
+    char spec[8] = { '%' };
+    uint8_t spec_length = 1;
+    while (c[1] >= '0' && c[1] <= '9' && spec_length < sizeof(spec) - 2)
+      spec[spec_length++] = *++c;
+    spec[spec_length] = *++c;
+
+    char field[MAVLINK_MSG_STATUSTEXT_FIELD_TEXT_LEN] = {};
+    if (*c == '%')
+      field[0] = '%';
+    else if (*c == 's' && arg < LOG_MAX_ARGS)
+      format_log_arg(field, spec, entry.args[arg++].string);
+    else if (arg < LOG_MAX_ARGS)
+      format_log_arg(field, spec, entry.args[arg++].value);
+
+    for (const char *f = field; *f != '\0' && length + 1 < size; f++)
+      text[length++] = *f;
+  }
+  text[length] = '\0';
 }
 
 void Mavlink::send_log_message(uint8_t severity, const char* text)
 {
-  mavlink_message_t msg;
-  mavlink_msg_statustext_pack(RF_.params_.get_param_int(PARAM_SYSTEM_ID), 0, &msg,
+  mavlink_msg_statustext_send(MAVLINK_COMM_0,
                               severity,
                               text);
-  send_message(msg);
 }
 
 
 void Mavlink::send_heartbeat(void)
 {
-  mavlink_message_t msg;
-  mavlink_msg_heartbeat_pack(RF_.params_.get_param_int(PARAM_SYSTEM_ID), 0, &msg,
+  mavlink_msg_heartbeat_send(MAVLINK_COMM_0,
                              RF_.params_.get_param_int(PARAM_FIXED_WING) ? MAV_TYPE_FIXED_WING : MAV_TYPE_QUADROTOR,
                              0, 0, 0, 0);
-  send_message(msg);
 }
 
 void Mavlink::send_status(void)
@@ -396,8 +936,7 @@ void Mavlink::send_status(void)
   else
     control_mode = MODE_ROLLRATE_PITCHRATE_YAWRATE_THROTTLE;
 
-  mavlink_message_t msg;
-  mavlink_msg_rosflight_status_pack(RF_.params_.get_param_int(PARAM_SYSTEM_ID), 0, &msg,
+  mavlink_msg_rosflight_status_send(MAVLINK_COMM_0,
                                     RF_.state_manager_.state().armed,
                                     RF_.state_manager_.state().failsafe,
                                     RF_.command_manager_.rc_override_active(),
@@ -406,15 +945,26 @@ void Mavlink::send_status(void)
                                     control_mode,
                                     RF_.board_.num_sensor_errors(),
                                     RF_.get_loop_time_us());
-  send_message(msg);
+
+  if (tx_dropped_messages_ != tx_dropped_reported_)
+  {
+    tx_dropped_reported_ = tx_dropped_messages_;
+    send_named_value_int("tx_dropped", static_cast<int32_t>(tx_dropped_messages_));
+  }
+  if (rx_budget_overruns_ != rx_budget_overruns_reported_)
+  {
+    rx_budget_overruns_reported_ = rx_budget_overruns_;
+    send_named_value_int("rx_overruns", static_cast<int32_t>(rx_budget_overruns_));
+  }
+  send_stream_rates();
 }
 
 
 void Mavlink::send_attitude(void)
 {
-  mavlink_message_t msg;
-  mavlink_msg_attitude_quaternion_pack(sysid_, compid_, &msg,
-                                       RF_.estimator_.state().timestamp_us / 1000,
+  // In the onboard computer's time this is milliseconds since its epoch, modulo 2^32
+  mavlink_msg_attitude_quaternion_send(MAVLINK_COMM_0,
+                                       static_cast<uint32_t>(stamp_us(RF_.estimator_.state().timestamp_us) / 1000),
                                        RF_.estimator_.state().attitude.w,
                                        RF_.estimator_.state().attitude.x,
                                        RF_.estimator_.state().attitude.y,
@@ -422,18 +972,21 @@ void Mavlink::send_attitude(void)
                                        RF_.estimator_.state().angular_velocity.x,
                                        RF_.estimator_.state().angular_velocity.y,
                                        RF_.estimator_.state().angular_velocity.z);
-  send_message(msg);
 }
 
 void Mavlink::send_imu(void)
 {
-  //  if(RF_.sensors_.should_send_imu_data())
-  //  {
-  mavlink_message_t msg;
+  uint32_t batch_size = imu_batch_size();
+  if (batch_size > 1)
+  {
+    send_imu_batch(batch_size);
+    return;
+  }
+
   turbomath::Vector accel = RF_.sensors_.data().accel;
   turbomath::Vector gyro = RF_.sensors_.data().gyro;
-  mavlink_msg_small_imu_pack(sysid_, compid_, &msg,
-                             RF_.sensors_.data().imu_time,
+  mavlink_msg_small_imu_send(MAVLINK_COMM_0,
+                             stamp_us(RF_.sensors_.data().imu_time),
                              accel.x,
                              accel.y,
                              accel.z,
@@ -441,29 +994,87 @@ void Mavlink::send_imu(void)
                              gyro.y,
                              gyro.z,
                              RF_.sensors_.data().imu_temperature);
-  send_message(msg);
-  //  }
-  //  else
-  //  {
-  // Otherwise, wait and signal that we still need to send IMU
-  //    mavlink_streams[STREAM_ID_IMU].next_time_us -= mavlink_streams[STREAM_ID_IMU].period_us;
-  //  }
+}
+
+uint32_t Mavlink::imu_batch_size(void)
+{
+  // A batch can only reach as far back as the sensor history
+  uint32_t batch_size = static_cast<uint32_t>(RF_.params_.get_param_int(PARAM_STREAM_IMU_BATCH));
+  uint32_t max_batch_size = (Sensors::IMU_HISTORY_LENGTH - 1) / imu_decimation_ + 1;
+  if (batch_size > MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_DT_US_LEN)
+    batch_size = MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_DT_US_LEN;
+  if (batch_size > max_batch_size)
+    batch_size = max_batch_size;
+  return (batch_size > 0) ? batch_size : 1;
+}
+
+void Mavlink::send_imu_batch(uint32_t batch_size)
+{
+  uint16_t dt_us[MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_DT_US_LEN] = {};
+  int16_t accel[MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_ACCEL_LEN] = {};
+  int16_t gyro[MAVLINK_MSG_ROSFLIGHT_IMU_BATCH_FIELD_GYRO_LEN] = {};
+  uint64_t time_us = 0;
+  uint8_t count = 0;
+
+  // Every imu_decimation_-th sample, ending with the newest
+  uint32_t first = RF_.sensors_.imu_sample_count() - 1 - (batch_size - 1)*imu_decimation_;
+  for (uint32_t i = 0; i < batch_size; i++)
+  {
+    Sensors::ImuSample sample;
+    if (!RF_.sensors_.imu_sample(first + i*imu_decimation_, &sample))
+      continue;
+
+    if (count == 0)
+      time_us = sample.time_us;
+    uint64_t dt = sample.time_us - time_us;
+    dt_us[count] = static_cast<uint16_t>(dt < UINT16_MAX ? dt : UINT16_MAX);
+
+    const float values[6] = { sample.accel.x / IMU_BATCH_ACCEL_SCALE, sample.accel.y / IMU_BATCH_ACCEL_SCALE,
+                              sample.accel.z / IMU_BATCH_ACCEL_SCALE, sample.gyro.x / IMU_BATCH_GYRO_SCALE,
+                              sample.gyro.y / IMU_BATCH_GYRO_SCALE, sample.gyro.z / IMU_BATCH_GYRO_SCALE };
+    for (uint8_t j = 0; j < 6; j++)
+    {
+      float value = (values[j] > INT16_MAX) ? INT16_MAX : (values[j] < -INT16_MAX) ? -INT16_MAX : values[j];
+      int16_t scaled = static_cast<int16_t>(value + (value > 0.0f ? 0.5f : -0.5f));
+      if (j < 3)
+        accel[3*count + j] = scaled;
+      else
+        gyro[3*count + j - 3] = scaled;
+    }
+    count++;
+  }
+  if (count == 0)
+    return;
 
+  mavlink_msg_rosflight_imu_batch_send(MAVLINK_COMM_0, stamp_us(time_us), IMU_BATCH_ACCEL_SCALE, IMU_BATCH_GYRO_SCALE,
+                                       RF_.sensors_.data().imu_temperature, dt_us, accel, gyro, count);
 }
 
 void Mavlink::send_output_raw(void)
 {
-  mavlink_message_t msg;
-  mavlink_msg_rosflight_output_raw_pack(sysid_, compid_, &msg,
+  mavlink_msg_rosflight_output_raw_send(MAVLINK_COMM_0,
                                         RF_.board_.clock_millis(),
                                         RF_.mixer_.get_outputs());
-  send_message(msg);
+
+  // ROSFLIGHT_OUTPUT_RAW only has room for 8 outputs, so on boards with more the rest are sent
+  // as PWM in SERVO_OUTPUT_RAW, using the port field to number each group of 8
+  const uint16_t *pwm = RF_.mixer_.get_pwm_outputs();
+  for (uint8_t port = 1; 8*port < Mixer::NUM_OUTPUTS; port++)
+  {
+    uint16_t values[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (uint8_t i = 0; i < 8 && 8*port + i < Mixer::NUM_OUTPUTS; i++)
+      values[i] = pwm[8*port + i];
+    mavlink_msg_servo_output_raw_send(MAVLINK_COMM_0,
+                                      RF_.board_.clock_micros(),
+                                      port,
+                                      values[0], values[1], values[2], values[3],
+                                      values[4], values[5], values[6], values[7]);
+  }
 }
 
 void Mavlink::send_rc_raw(void)
 {
-  mavlink_message_t msg;
-  mavlink_msg_rc_channels_pack(sysid_, compid_, &msg,
+  mavlink_msg_rc_channels_send(MAVLINK_COMM_0,
                                RF_.board_.clock_millis(),
                                0,
                                RF_.board_.pwm_read(0),
@@ -475,19 +1086,16 @@ void Mavlink::send_rc_raw(void)
                                RF_.board_.pwm_read(6),
                                RF_.board_.pwm_read(7),
                                0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 0);
-  send_message(msg);
 }
 
 void Mavlink::send_diff_pressure(void)
 {
   if (RF_.sensors_.data().diff_pressure_valid)
   {
-    mavlink_message_t msg;
-    mavlink_msg_diff_pressure_pack(sysid_, compid_, &msg,
+    mavlink_msg_diff_pressure_send(MAVLINK_COMM_0,
                                    RF_.sensors_.data().diff_pressure_velocity,
                                    RF_.sensors_.data().diff_pressure,
                                    RF_.sensors_.data().diff_pressure_temp);
-    send_message(msg);
   }
 }
 
@@ -495,12 +1103,10 @@ void Mavlink::send_baro(void)
 {
   if (RF_.sensors_.data().baro_valid)
   {
-    mavlink_message_t msg;
-    mavlink_msg_small_baro_pack(sysid_, compid_, &msg,
+    mavlink_msg_small_baro_send(MAVLINK_COMM_0,
                                 RF_.sensors_.data().baro_altitude,
                                 RF_.sensors_.data().baro_pressure,
                                 RF_.sensors_.data().baro_temperature);
-    send_message(msg);
   }
 }
 
@@ -508,13 +1114,11 @@ void Mavlink::send_sonar(void)
 {
   if (RF_.sensors_.data().sonar_range_valid)
   {
-    mavlink_message_t msg;
-    mavlink_msg_small_range_pack(sysid_, compid_, &msg,
+    mavlink_msg_small_range_send(MAVLINK_COMM_0,
                                  ROSFLIGHT_RANGE_SONAR,
                                  RF_.sensors_.data().sonar_range,
                                  8.0,
                                  0.25);
-    send_message(msg);
   }
 }
 
@@ -522,27 +1126,63 @@ void Mavlink::send_mag(void)
 {
   if (RF_.sensors_.data().mag_present)
   {
-    mavlink_message_t msg;
-    mavlink_msg_small_mag_pack(sysid_, compid_, &msg,
+    mavlink_msg_small_mag_send(MAVLINK_COMM_0,
                                RF_.sensors_.data().mag.x,
                                RF_.sensors_.data().mag.y,
                                RF_.sensors_.data().mag.z);
-    send_message(msg);
   }
 }
 
 void Mavlink::send_low_priority(void)
 {
-  send_next_param();
+  if (log_tail_ != log_head_)
+    send_next_log();
+  else if (param_blob_length_ > 0)
+    send_next_param_chunk();
+  else
+    send_next_param();
+}
+
+void Mavlink::send_timesync(void)
+{
+  // Only the newest request is matched, an answer to an older one is too late to be worth using
+  timesync_request_us_ = RF_.board_.clock_micros();
+  timesync_pending_ = true;
+  mavlink_msg_timesync_send(MAVLINK_COMM_0, 0, static_cast<int64_t>(timesync_request_us_)*1000);
 }
 
 // function definitions
 void Mavlink::stream()
 {
+  flush_tx();
+
+  // Credit the bytes the link could have carried since the last call, but don't bank more than
+  // the transmit buffer can hold.  Messages sent outside of the streams (logs, params, acks) are
+  // charged here too.
   uint64_t time_us = RF_.board_.clock_micros();
+  tx_budget_bytes_ += (time_us - last_stream_time_us_) * link_bytes_per_us_;
+  tx_budget_bytes_ -= tx_bytes_queued_ - tx_bytes_charged_;
+  tx_bytes_charged_ = tx_bytes_queued_;
+  if (tx_budget_bytes_ > TX_BUFFER_SIZE)
+    tx_budget_bytes_ = TX_BUFFER_SIZE;
+  last_stream_time_us_ = time_us;
+
+  // The IMU stream follows the samples instead of a timer.  A sample is only sent in the loop it
+  // arrived in, so no sample goes out twice and the spacing stays even; if the link can't take
+  // it then, it is skipped.
+  mavlink_stream_t &imu_stream = mavlink_streams_[STREAM_ID_IMU];
+  imu_stream.pending = false;
+  uint32_t imu_samples = RF_.sensors_.imu_sample_count();
+  if (imu_samples != imu_samples_seen_)
+  {
+    imu_samples_seen_ = imu_samples;
+    imu_stream.pending = imu_stream.period_us > 0 && imu_samples % (imu_decimation_ * imu_batch_size()) == 0;
+  }
+
+  bool any_pending = false;
   for (int i = 0; i < STREAM_COUNT; i++)
   {
-    if (mavlink_streams_[i].period_us > 0 && time_us >= mavlink_streams_[i].next_time_us)
+    if (i != STREAM_ID_IMU && mavlink_streams_[i].period_us > 0 && time_us >= mavlink_streams_[i].next_time_us)
     {
       // If you fall behind, skip messages
       do
@@ -550,8 +1190,89 @@ void Mavlink::stream()
         mavlink_streams_[i].next_time_us += mavlink_streams_[i].period_us;
       } while(mavlink_streams_[i].next_time_us < time_us);
 
-      (this->*mavlink_streams_[i].send_function)();
+      mavlink_streams_[i].pending = true;
     }
+    any_pending |= mavlink_streams_[i].pending;
+  }
+
+  // Deficit round robin: each pass gives every pending stream its quantum, and a stream is sent
+  // once it has saved up enough for its message.  When the budget runs out, the stream whose
+  // turn it was goes first next time.
+  while (any_pending)
+  {
+    any_pending = false;
+    for (int n = 0; n < STREAM_COUNT; n++)
+    {
+      uint8_t i = static_cast<uint8_t>((next_stream_ + n) % STREAM_COUNT);
+      mavlink_stream_t &stream = mavlink_streams_[i];
+      if (!stream.pending)
+      {
+        stream.deficit_bytes = 0;
+        continue;
+      }
+
+      if (stream.deficit_bytes < stream.size_bytes)
+        stream.deficit_bytes = static_cast<uint16_t>(stream.deficit_bytes + stream.priority*STREAM_QUANTUM_BYTES);
+      if (stream.deficit_bytes < stream.size_bytes)
+      {
+        any_pending = true;
+        continue;
+      }
+
+      if (stream.size_bytes > tx_budget_bytes_ || stream.size_bytes > tx_buffer_.space())
+      {
+        next_stream_ = i;
+        return;
+      }
+
+      (this->*stream.send_function)();
+      stream.size_bytes = static_cast<uint16_t>(tx_bytes_queued_ - tx_bytes_charged_);
+      stream.deficit_bytes = (stream.deficit_bytes > stream.size_bytes) ?
+                             static_cast<uint16_t>(stream.deficit_bytes - stream.size_bytes) : 0;
+      tx_budget_bytes_ -= stream.size_bytes;
+      tx_bytes_charged_ = tx_bytes_queued_;
+      stream.pending = false;
+      stream.sent_count++;
+    }
+  }
+}
+
+void Mavlink::update_imu_decimation(float window_s)
+{
+  // The IMU rate is fixed by the hardware, so the divisor settles after the first second
+  float imu_rate_hz = (imu_samples_seen_ - imu_samples_window_start_) / window_s;
+  imu_samples_window_start_ = imu_samples_seen_;
+
+  uint32_t period_us = mavlink_streams_[STREAM_ID_IMU].period_us;
+  if (period_us == 0)
+    return;
+  uint32_t decimation = static_cast<uint32_t>(imu_rate_hz * period_us * 1e-6f + 0.5f);
+  imu_decimation_ = (decimation > 0) ? decimation : 1;
+}
+
+void Mavlink::send_stream_rates(void)
+{
+  // Only streams that are falling short of their requested rate are reported, measured over at
+  // least a second since status is also sent whenever the state changes
+  static const char *const names[STREAM_COUNT] = { "hb_hz", "status_hz", "att_hz", "imu_hz", "diff_hz", "baro_hz",
+                                                   "sonar_hz", "mag_hz", "output_hz", "rc_hz", "lowpri_hz",
+                                                   "tsync_hz" };
+  uint64_t now_us = RF_.board_.clock_micros();
+  if (now_us - rate_window_start_us_ < 1000000)
+    return;
+  float window_s = (now_us - rate_window_start_us_) * 1e-6f;
+  rate_window_start_us_ = now_us;
+  update_imu_decimation(window_s);
+
+  for (uint8_t i = 0; i < STREAM_COUNT; i++)
+  {
+    mavlink_stream_t &stream = mavlink_streams_[i];
+    float achieved_hz = stream.sent_count / window_s;
+    if (i == STREAM_ID_IMU)
+      achieved_hz *= imu_batch_size();
+    stream.sent_count = 0;
+    if (stream.period_us > 0 && stream.size_bytes > 0 && achieved_hz < 0.9f * 1e6f / stream.period_us)
+      send_named_value_float(names[i], achieved_hz);
   }
 }
 
@@ -568,16 +1289,12 @@ void Mavlink::stream_set_period(uint8_t stream_id, uint32_t period_us)
 
 void Mavlink::send_named_value_int(const char *const name, int32_t value)
 {
-  mavlink_message_t msg;
-  mavlink_msg_named_value_int_pack(sysid_, compid_, &msg, RF_.board_.clock_millis(), name, value);
-  send_message(msg);
+  mavlink_msg_named_value_int_send(MAVLINK_COMM_0, RF_.board_.clock_millis(), name, value);
 }
 
 void Mavlink::send_named_value_float(const char *const name, float value)
 {
-  mavlink_message_t msg;
-  mavlink_msg_named_value_float_pack(sysid_, compid_, &msg, RF_.board_.clock_millis(), name, value);
-  send_message(msg);
+  mavlink_msg_named_value_float_send(MAVLINK_COMM_0, RF_.board_.clock_millis(), name, value);
 }
 
 //void Mavlink::mavlink_send_named_command_struct(const char *const name, control_t command_struct)
@@ -606,15 +1323,13 @@ void Mavlink::send_named_value_float(const char *const name, float value)
 //                   !(command_struct.y.active) << 1 ||
 //                   !(command_struct.z.active) << 2 ||
 //                   !(command_struct.F.active) << 3;
-//  mavlink_message_t msg;
-//  mavlink_msg_named_command_struct_pack(sysid, compid, &msg, name,
+//  mavlink_msg_named_command_struct_send(MAVLINK_COMM_0, name,
 //                                        control_mode,
 //                                        ignore,
 //                                        command_struct.x.value,
 //                                        command_struct.y.value,
 //                                        command_struct.z.value,
 //                                        command_struct.F.value);
-//  send_message(msg);
 //}
 
 
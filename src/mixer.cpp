@@ -31,22 +31,53 @@
 
 #include <stdint.h>
 
+#include <turbomath/turbomath.h>
+
 #include "mixer.h"
 #include "rosflight.h"
 
 namespace rosflight_firmware
 {
 
+// The mixer tables live in flash, only the pointer to the active one is kept in RAM
+constexpr Mixer::mixer_t Mixer::esc_calibration_mixing;
+constexpr Mixer::mixer_t Mixer::quadcopter_plus_mixing;
+constexpr Mixer::mixer_t Mixer::quadcopter_x_mixing;
+constexpr Mixer::mixer_t Mixer::hex_plus_mixing;
+constexpr Mixer::mixer_t Mixer::hex_x_mixing;
+constexpr Mixer::mixer_t Mixer::octocopter_plus_mixing;
+constexpr Mixer::mixer_t Mixer::octocopter_x_mixing;
+constexpr Mixer::mixer_t Mixer::Y6_mixing;
+constexpr Mixer::mixer_t Mixer::X8_mixing;
+constexpr Mixer::mixer_t Mixer::tricopter_mixing;
+constexpr Mixer::mixer_t Mixer::fixedwing_mixing;
+constexpr const Mixer::mixer_t *Mixer::array_of_mixers_[Mixer::NUM_MIXERS];
+constexpr uint8_t Mixer::NUM_OUTPUTS;
+constexpr uint8_t Mixer::NO_FAILURE;
+
 Mixer::Mixer(ROSflight &_rf) :
-  RF_(_rf)
+  RF_(_rf),
+  airmode_active_(false),
+  failed_motor_(NO_FAILURE)
 {}
 
 void Mixer::init()
 {
+  // The mixer is registered first, since the output scaling depends on it
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MIXER);
   RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MOTOR_PWM_SEND_RATE);
   RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MOTOR_MIN_PWM);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MOTOR_MAX_PWM);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MOTOR_IDLE_THROTTLE);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_SPIN_MOTORS_WHEN_ARMED);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_THRUST_EXPO);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_BATTERY_VOLTAGE_REFERENCE);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MOTOR_PROTOCOL);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_DSHOT_BIDIRECTIONAL);
+  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MOTOR_POLES);
   RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_RC_TYPE);
-  RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), PARAM_MIXER);
+  for (uint16_t id = PARAM_CUSTOM_MIXER_TYPES; id <= PARAM_CUSTOM_MIXER_7_YZ; id++)
+    RF_.params_.add_callback(std::bind(&Mixer::param_change_callback, this, std::placeholders::_1), id);
 
   init_mixing();
   init_PWM();
@@ -54,11 +85,29 @@ void Mixer::init()
 
 void Mixer::param_change_callback(uint16_t param_id)
 {
+  if (param_id >= PARAM_CUSTOM_MIXER_TYPES && param_id <= PARAM_CUSTOM_MIXER_7_YZ)
+  {
+    if (RF_.params_.get_param_int(PARAM_MIXER) == CUSTOM)
+      init_mixing();
+    return;
+  }
+
   switch (param_id)
   {
   case PARAM_MIXER:
     init_mixing();
     break;
+  case PARAM_MOTOR_MAX_PWM:
+  case PARAM_MOTOR_IDLE_THROTTLE:
+  case PARAM_SPIN_MOTORS_WHEN_ARMED:
+  case PARAM_THRUST_EXPO:
+  case PARAM_BATTERY_VOLTAGE_REFERENCE:
+    init_output_scaling();
+    break;
+  case PARAM_MOTOR_MIN_PWM:
+    init_PWM();
+    init_output_scaling();
+    break;
   default:
     init_PWM();
     break;
@@ -82,12 +131,242 @@ void Mixer::init_mixing()
     RF_.state_manager_.set_error(StateManager::ERROR_INVALID_MIXER);
   }
 
-  mixer_to_use_ = array_of_mixers_[mixer_choice];
+  if (mixer_choice == CUSTOM)
+  {
+    init_custom_mixing();
+    mixer_to_use_ = &custom_mixing_;
+  }
+  else
+  {
+    mixer_to_use_ = array_of_mixers_[mixer_choice];
+  }
+  nominal_mixer_ = mixer_to_use_;
+  failed_motor_ = NO_FAILURE;
 
-  for (int8_t i=0; i<8; i++)
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
   {
     raw_outputs_[i] = 0.0f;
     unsaturated_outputs_[i] = 0.0f;
+    mixed_outputs_[i] = 0.0f;
+    pwm_outputs_[i] = 0;
+    motor_telemetry_us_[i] = 0;
+    motor_fault_start_us_[i] = 0;
+  }
+
+  init_failure_mixing();
+
+  init_output_scaling();
+}
+
+void Mixer::init_failure_mixing()
+{
+  // Mixer columns are the F, x, y and z coefficients of each output
+  const float *columns[4] = { nominal_mixer_->F, nominal_mixer_->x, nominal_mixer_->y, nominal_mixer_->z };
+
+  uint8_t num_motors = 0;
+  float column_norm[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+  {
+    failure_fit_index_[i] = NO_FAILURE;
+    if (nominal_mixer_->output_type[i] == M && nominal_mixer_->F[i] != 0.0f)
+      num_motors++;
+    for (uint8_t j = 0; j < 4; j++)
+      column_norm[j] += columns[j][i] * columns[j][i];
+  }
+
+  // Losing a motor on a quad or tricopter leaves too few to control all four axes
+  if (num_motors < FAILURE_MIN_MOTORS || num_motors > FAILURE_MAX_MOTORS)
+    return;
+
+  // Treating the mixer as the (scaled) transpose of the control effectiveness, the mixer that
+  // produces the same forces and torques without motor k is P_k * inv(P_k' * P_k) * diag(P' * P),
+  // where P_k is the nominal mixer with row k zeroed.  This reproduces the nominal mixer when
+  // nothing has failed.  Only inv(P_k' * P_k) * diag(P' * P) is kept.
+  uint8_t num_fits = 0;
+  for (uint8_t k = 0; k < NUM_OUTPUTS; k++)
+  {
+    if (nominal_mixer_->output_type[k] != M || nominal_mixer_->F[k] == 0.0f)
+      continue;
+
+    float A[4][4] = {{0.0f}};
+    for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+    {
+      if (i == k || nominal_mixer_->output_type[i] != M)
+        continue;
+      for (uint8_t l = 0; l < 4; l++)
+        for (uint8_t j = 0; j < 4; j++)
+          A[l][j] += columns[l][i] * columns[j][i];
+    }
+
+    float (&fit)[4][4] = failure_fit_[num_fits];
+    if (!invert_4x4(A, fit))
+      continue;
+    for (uint8_t l = 0; l < 4; l++)
+      for (uint8_t j = 0; j < 4; j++)
+        fit[l][j] *= column_norm[j];
+    failure_fit_index_[k] = num_fits++;
+  }
+}
+
+void Mixer::build_failure_mixing(uint8_t failed_motor)
+{
+  const float *columns[4] = { nominal_mixer_->F, nominal_mixer_->x, nominal_mixer_->y, nominal_mixer_->z };
+  float *reduced_columns[4] = { failure_mixing_.F, failure_mixing_.x, failure_mixing_.y, failure_mixing_.z };
+  const float (&fit)[4][4] = failure_fit_[failure_fit_index_[failed_motor]];
+  for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+  {
+    failure_mixing_.output_type[i] = nominal_mixer_->output_type[i];
+    for (uint8_t j = 0; j < 4; j++)
+    {
+      if (nominal_mixer_->output_type[i] != M)
+      {
+        reduced_columns[j][i] = columns[j][i];
+      }
+      else if (i == failed_motor)
+      {
+        // The failed motor stays a motor so it is still held at idle
+        reduced_columns[j][i] = 0.0f;
+      }
+      else
+      {
+        float value = 0.0f;
+        for (uint8_t l = 0; l < 4; l++)
+          value += columns[l][i] * fit[l][j];
+        reduced_columns[j][i] = value;
+      }
+    }
+  }
+}
+
+bool Mixer::invert_4x4(float A[4][4], float inverse[4][4])
+{
+  // Gauss-Jordan elimination with partial pivoting, A is destroyed
+  for (uint8_t i = 0; i < 4; i++)
+    for (uint8_t j = 0; j < 4; j++)
+      inverse[i][j] = (i == j) ? 1.0f : 0.0f;
+
+  for (uint8_t col = 0; col < 4; col++)
+  {
+    uint8_t pivot = col;
+    for (uint8_t row = col; row < 4; row++)
+      if (turbomath::fabs(A[row][col]) > turbomath::fabs(A[pivot][col]))
+        pivot = row;
+
+    if (turbomath::fabs(A[pivot][col]) < 1e-3f)
+      return false;
+
+    for (uint8_t j = 0; j < 4; j++)
+    {
+      float tmp = A[col][j];
+      A[col][j] = A[pivot][j];
+      A[pivot][j] = tmp;
+      tmp = inverse[col][j];
+      inverse[col][j] = inverse[pivot][j];
+      inverse[pivot][j] = tmp;
+    }
+
+    float scale = 1.0f / A[col][col];
+    for (uint8_t j = 0; j < 4; j++)
+    {
+      A[col][j] *= scale;
+      inverse[col][j] *= scale;
+    }
+
+    for (uint8_t row = 0; row < 4; row++)
+    {
+      if (row == col)
+        continue;
+      float factor = A[row][col];
+      for (uint8_t j = 0; j < 4; j++)
+      {
+        A[row][j] -= factor * A[col][j];
+        inverse[row][j] -= factor * inverse[col][j];
+      }
+    }
+  }
+  return true;
+}
+
+void Mixer::init_output_scaling()
+{
+  motor_idle_ = RF_.params_.get_param_int(PARAM_SPIN_MOTORS_WHEN_ARMED) ?
+                RF_.params_.get_param_float(PARAM_MOTOR_IDLE_THROTTLE) : 0.0f;
+  float min_pwm = RF_.params_.get_param_int(PARAM_MOTOR_MIN_PWM);
+  float max_pwm = RF_.params_.get_param_int(PARAM_MOTOR_MAX_PWM);
+
+  // Invert thrust = (1 - expo)*throttle + expo*throttle^2 at evenly spaced thrusts
+  float expo = RF_.params_.get_param_float(PARAM_THRUST_EXPO);
+  for (uint8_t i = 0; i <= THRUST_CURVE_SEGMENTS; i++)
+  {
+    float thrust = static_cast<float>(i) / THRUST_CURVE_SEGMENTS;
+    if (expo > 0.0f)
+    {
+      float discriminant = (1.0f - expo)*(1.0f - expo) + 4.0f*expo*thrust;
+      float root = (discriminant > 0.0f) ? 1.0f/turbomath::inv_sqrt(discriminant) : 0.0f;
+      thrust_curve_[i] = (root - (1.0f - expo)) / (2.0f*expo);
+    }
+    else
+    {
+      thrust_curve_[i] = thrust;
+    }
+  }
+  thrust_expo_ = expo;
+  battery_reference_ = RF_.params_.get_param_float(PARAM_BATTERY_VOLTAGE_REFERENCE);
+
+  // Unused outputs are held at the minimum PWM, like pwm_init() leaves them
+  num_motor_outputs_ = 0;
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
+  {
+    switch (mixer_to_use_->output_type[i])
+    {
+    case M:
+      motor_outputs_[num_motor_outputs_++] = i;
+      output_min_[0][i] = 0.0f;
+      output_max_[0][i] = 0.0f;
+      output_min_[1][i] = motor_idle_;
+      output_max_[1][i] = 1.0f;
+      pwm_scale_[i] = max_pwm - min_pwm;
+      pwm_offset_[i] = min_pwm;
+      break;
+    case S:
+      output_min_[0][i] = output_min_[1][i] = -1.0f;
+      output_max_[0][i] = output_max_[1][i] = 1.0f;
+      pwm_scale_[i] = 500.0f;
+      pwm_offset_[i] = 1500.0f;
+      break;
+    default:
+      output_min_[0][i] = output_min_[1][i] = 0.0f;
+      output_max_[0][i] = output_max_[1][i] = 0.0f;
+      pwm_scale_[i] = 0.0f;
+      pwm_offset_[i] = min_pwm;
+      break;
+    }
+  }
+}
+
+void Mixer::init_custom_mixing()
+{
+  // Output types are packed two bits per output, and each output's coefficients are packed
+  // in pairs of int16 (F and x, then y and z), high half first.  There are only params for the
+  // first 8 outputs, any others are unused.
+  uint32_t types = static_cast<uint32_t>(RF_.params_.get_param_int(PARAM_CUSTOM_MIXER_TYPES));
+  for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+  {
+    if (i >= NUM_CUSTOM_OUTPUTS)
+    {
+      custom_mixing_.output_type[i] = NONE;
+      custom_mixing_.F[i] = custom_mixing_.x[i] = custom_mixing_.y[i] = custom_mixing_.z[i] = 0.0f;
+      continue;
+    }
+
+    custom_mixing_.output_type[i] = static_cast<output_type_t>((types >> (2*i)) & 0x03);
+
+    uint32_t fx = static_cast<uint32_t>(RF_.params_.get_param_int(PARAM_CUSTOM_MIXER_0_FX + 2*i));
+    uint32_t yz = static_cast<uint32_t>(RF_.params_.get_param_int(PARAM_CUSTOM_MIXER_0_YZ + 2*i));
+    custom_mixing_.F[i] = static_cast<int16_t>(fx >> 16) * CUSTOM_MIXER_SCALE;
+    custom_mixing_.x[i] = static_cast<int16_t>(fx & 0xFFFF) * CUSTOM_MIXER_SCALE;
+    custom_mixing_.y[i] = static_cast<int16_t>(yz >> 16) * CUSTOM_MIXER_SCALE;
+    custom_mixing_.z[i] = static_cast<int16_t>(yz & 0xFFFF) * CUSTOM_MIXER_SCALE;
   }
 }
 
@@ -101,57 +380,155 @@ void Mixer::init_PWM()
   int16_t motor_refresh_rate = RF_.params_.get_param_int(PARAM_MOTOR_PWM_SEND_RATE);
   int16_t off_pwm = RF_.params_.get_param_int(PARAM_MOTOR_MIN_PWM);
   RF_.board_.pwm_init(useCPPM, motor_refresh_rate, off_pwm);
+
+  // DShot takes over the motor outputs if the board supports it (RC input stays with pwm_init)
+  dshot_bit_ticks_ = 0;
+  dshot_bidirectional_ = RF_.params_.get_param_int(PARAM_DSHOT_BIDIRECTIONAL);
+  uint32_t bitrate = DShot::bitrate(static_cast<DShot::Protocol>(RF_.params_.get_param_int(PARAM_MOTOR_PROTOCOL)));
+  if (bitrate > 0)
+  {
+    dshot_bit_ticks_ = RF_.board_.dshot_init(bitrate, dshot_bidirectional_);
+    if (dshot_bit_ticks_ == 0)
+      RF_.mavlink_.log(Mavlink::LOG_ERROR, "DShot not supported on this board, using PWM");
+  }
+
+  erpm_to_rpm_ = 2.0f / RF_.params_.get_param_int(PARAM_MOTOR_POLES);
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
+    motor_rpm_[i] = 0.0f;
 }
 
 
-void Mixer::write_motor(uint8_t index, float value)
+void Mixer::desaturate_motors(float throttle, const float *thrust, float *roll_pitch, const float *yaw,
+                              float lower, float upper)
 {
-  if (RF_.state_manager_.state().armed)
+  const float range = upper - lower;
+
+  // Air mode only engages once the throttle has been raised after arming, so that the motors
+  // don't spin up while sitting on the ground
+  airmode_active_ = RF_.state_manager_.state().armed && (airmode_active_ || throttle > 0.1f);
+  const bool airmode = airmode_active_ && RF_.params_.get_param_int(PARAM_MIXER_AIRMODE);
+
+  // Roll and pitch have priority, so they are only scaled down if their spread alone doesn't fit
+  float rp_min = 0.0f, rp_max = 0.0f;
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
   {
-    if (value > 1.0)
-    {
-      value = 1.0;
-    }
-    else if (value < RF_.params_.get_param_float(PARAM_MOTOR_IDLE_THROTTLE)
-             && RF_.params_.get_param_int(PARAM_SPIN_MOTORS_WHEN_ARMED))
+    if (mixer_to_use_->output_type[i] != M)
+      continue;
+    if (roll_pitch[i] < rp_min)
+      rp_min = roll_pitch[i];
+    if (roll_pitch[i] > rp_max)
+      rp_max = roll_pitch[i];
+  }
+  if (rp_max - rp_min > range)
+  {
+    float scale = range / (rp_max - rp_min);
+    for (int8_t i=0; i<NUM_OUTPUTS; i++)
+      roll_pitch[i] *= scale;
+  }
+
+  // Then try to fit the full yaw command by shifting throttle
+  float out_min = 1.0f, out_max = 0.0f;
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
+  {
+    if (mixer_to_use_->output_type[i] != M)
+      continue;
+    float out = thrust[i] + roll_pitch[i] + yaw[i];
+    if (out < out_min)
+      out_min = out;
+    if (out > out_max)
+      out_max = out;
+  }
+
+  float shift;
+  float yaw_scale = 1.0f;
+  if (out_max - out_min <= range)
+  {
+    shift = throttle_shift(out_min, out_max, lower, upper, airmode);
+  }
+  else
+  {
+    // Yaw doesn't fit, so fit throttle around roll and pitch and give yaw whatever headroom is left
+    out_min = 1.0f;
+    out_max = 0.0f;
+    for (int8_t i=0; i<NUM_OUTPUTS; i++)
     {
-      value = RF_.params_.get_param_float(PARAM_MOTOR_IDLE_THROTTLE);
+      if (mixer_to_use_->output_type[i] != M)
+        continue;
+      float out = thrust[i] + roll_pitch[i];
+      if (out < out_min)
+        out_min = out;
+      if (out > out_max)
+        out_max = out;
     }
-    else if (value < 0.0)
+    shift = throttle_shift(out_min, out_max, lower, upper, airmode);
+
+    // A motor already at (or past) a limit leaves no room for yaw in that direction at all
+    for (int8_t i=0; i<NUM_OUTPUTS; i++)
     {
-      value = 0.0;
+      if (mixer_to_use_->output_type[i] != M)
+        continue;
+      float out = thrust[i] + roll_pitch[i] + shift;
+      if (yaw[i] > 0.0f && (upper - out) < yaw_scale*yaw[i])
+        yaw_scale = (out < upper) ? (upper - out) / yaw[i] : 0.0f;
+      else if (yaw[i] < 0.0f && (out - lower) < -yaw_scale*yaw[i])
+        yaw_scale = (out > lower) ? (out - lower) / -yaw[i] : 0.0f;
     }
   }
-  else
+
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
   {
-    value = 0.0;
+    if (mixer_to_use_->output_type[i] == M)
+      unsaturated_outputs_[i] = thrust[i] + roll_pitch[i] + shift + yaw_scale*yaw[i];
   }
-  raw_outputs_[index] = value;
-  int32_t pwm_us = value * (RF_.params_.get_param_int(PARAM_MOTOR_MAX_PWM) - RF_.params_.get_param_int(
-                              PARAM_MOTOR_MIN_PWM)) + RF_.params_.get_param_int(PARAM_MOTOR_MIN_PWM);
-  RF_.board_.pwm_write(index, pwm_us);
 }
 
+float Mixer::throttle_shift(float out_min, float out_max, float lower, float upper, bool airmode)
+{
+  // Throttle always gives way at the top, and at the bottom only in air mode
+  if (out_max > upper)
+    return upper - out_max;
+  if (airmode && out_min < lower)
+    return (lower - out_min < upper - out_max) ? lower - out_min : upper - out_max;
+  return 0.0f;
+}
 
-void Mixer::write_servo(uint8_t index, float value)
+float Mixer::battery_scale()
 {
-  if (value > 1.0)
-  {
-    value = 1.0;
-  }
-  else if (value < -1.0)
-  {
-    value = -1.0;
-  }
-  raw_outputs_[index] = value;
-  RF_.board_.pwm_write(index, raw_outputs_[index] * 500 + 1500);
+  // Motor thrust goes roughly with the square of the voltage they see, so scale the throttle
+  // by how far the battery is from the reference voltage the vehicle was tuned at
+  const Sensors::Data& sensors = RF_.sensors_.data();
+  if (battery_reference_ <= 0.0f || !sensors.battery_present)
+    return 1.0f;
+  float scale = battery_reference_ / sensors.battery_voltage;
+  scale = (scale < BATTERY_SCALE_MIN) ? BATTERY_SCALE_MIN : scale;
+  return (scale > BATTERY_SCALE_MAX) ? BATTERY_SCALE_MAX : scale;
 }
 
+float Mixer::thrust_to_throttle(float thrust) const
+{
+  if (thrust <= 0.0f)
+    return thrust;
+
+  // Linear interpolation in the thrust curve
+  float x = thrust * THRUST_CURVE_SEGMENTS;
+  uint8_t index = (x < THRUST_CURVE_SEGMENTS) ? static_cast<uint8_t>(x) : THRUST_CURVE_SEGMENTS - 1;
+  return thrust_curve_[index] + (x - index)*(thrust_curve_[index + 1] - thrust_curve_[index]);
+}
 
 void Mixer::mix_output()
 {
+  const uint8_t armed = RF_.state_manager_.state().armed ? 1 : 0;
+
+  // Check the motors against the telemetry they sent back after the last write, and switch to
+  // the matching reduced mixer before this one is computed
+  if (dshot_bit_ticks_ > 0 && dshot_bidirectional_)
+  {
+    uint64_t now_us = RF_.estimator_.state().timestamp_us;
+    read_dshot_telemetry(now_us);
+    detect_motor_failure(now_us, armed);
+  }
+
   Controller::Output commands = RF_.controller_.output();
-  float max_output = 1.0f;
 
   // Reverse Fixedwing channels just before mixing if we need to
   if (RF_.params_.get_param_int(PARAM_FIXED_WING))
@@ -161,45 +538,155 @@ void Mixer::mix_output()
     commands.z *= RF_.params_.get_param_int(PARAM_RUDDER_REVERSE) ? -1 : 1;
   }
 
-  for (int8_t i=0; i<8; i++)
+  // Matrix multiply to mix outputs, keeping the thrust, roll/pitch and yaw parts separate so
+  // that the motors can be desaturated in priority order
+  float thrust[NUM_OUTPUTS], roll_pitch[NUM_OUTPUTS], yaw[NUM_OUTPUTS];
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
   {
-    if (mixer_to_use_->output_type[i] != NONE)
-    {
-      // Matrix multiply to mix outputs
-      unsaturated_outputs_[i] = (commands.F*mixer_to_use_->F[i] + commands.x*mixer_to_use_->x[i] +
-                              commands.y*mixer_to_use_->y[i] + commands.z*mixer_to_use_->z[i]);
+    thrust[i] = commands.F*mixer_to_use_->F[i];
+    roll_pitch[i] = commands.x*mixer_to_use_->x[i] + commands.y*mixer_to_use_->y[i];
+    yaw[i] = commands.z*mixer_to_use_->z[i];
+    unsaturated_outputs_[i] = thrust[i] + roll_pitch[i] + yaw[i];
+  }
 
-      // Save off the largest control output if it is greater than 1.0 for future scaling
-      if (unsaturated_outputs_[i] > max_output)
-      {
-        max_output = unsaturated_outputs_[i];
-      }
-    }
+  // Motors are desaturated in thrust, against the thrusts that the thrust curve and battery scaling
+  // turn into the idle and full throttle commands, so that shaping never pushes them back out of
+  // range.  The ESC calibration mixer passes the throttle straight through.
+  const bool shape = (nominal_mixer_ != &esc_calibration_mixing);
+  const float scale = shape ? battery_scale() : 1.0f;
+  float lower = motor_idle_;
+  float upper = 1.0f;
+  if (shape)
+  {
+    lower = throttle_to_thrust(motor_idle_ / scale);
+    upper = (scale > 1.0f) ? throttle_to_thrust(1.0f / scale) : 1.0f;
   }
 
   // saturate outputs to maintain controllability even during aggressive maneuvers
-  float scale_factor = 1.0;
-  if (max_output > 1.0)
+  desaturate_motors(commands.F, thrust, roll_pitch, yaw, lower, upper);
+
+  // Clamp every output to its range (motors are held off while disarmed) and convert to PWM.
+  // Without shaping the motor range is the same in thrust as in throttle, so this is all they need.
+  const float *out_min = output_min_[armed];
+  const float *out_max = output_max_[armed];
+  for (int8_t i=0; i<NUM_OUTPUTS; i++)
   {
-    scale_factor = 1.0/max_output;
+    float value = unsaturated_outputs_[i];
+    value = (value < out_min[i]) ? out_min[i] : value;
+    value = (value > out_max[i]) ? out_max[i] : value;
+    mixed_outputs_[i] = value;
+    raw_outputs_[i] = value;
+    pwm_outputs_[i] = static_cast<uint16_t>(value*pwm_scale_[i] + pwm_offset_[i]);
   }
 
+  // Otherwise the motors are redone, clamped in thrust and then turned into throttle commands
+  if (shape)
+  {
+    const float motor_min = armed ? lower : 0.0f;
+    const float motor_max = armed ? upper : 0.0f;
+    for (uint8_t k=0; k<num_motor_outputs_; k++)
+    {
+      const uint8_t i = motor_outputs_[k];
+      float value = unsaturated_outputs_[i];
+      value = (value < motor_min) ? motor_min : value;
+      value = (value > motor_max) ? motor_max : value;
+      mixed_outputs_[i] = value;
+      value = thrust_to_throttle(value) * scale;
+      value = (value < out_min[i]) ? out_min[i] : value;
+      value = (value > out_max[i]) ? out_max[i] : value;
+      raw_outputs_[i] = value;
+      pwm_outputs_[i] = static_cast<uint16_t>(value*pwm_scale_[i] + pwm_offset_[i]);
+    }
+  }
 
+  // Every channel is written in a single call
+  if (dshot_bit_ticks_ > 0)
+    write_dshot(armed);
+  else
+    RF_.board_.pwm_write_all(pwm_outputs_, NUM_OUTPUTS);
+}
 
-  for (int8_t i=0; i<8; i++)
+void Mixer::read_dshot_telemetry(uint64_t now_us)
+{
+  // Pick up the eRPM the ESCs sent back after the previous frame
+  for (uint8_t i=0; i<NUM_OUTPUTS; i++)
   {
-    // Write output to motors
-    if (mixer_to_use_->output_type[i] == S)
+    uint32_t raw, erpm;
+    if (mixer_to_use_->output_type[i] == M
+        && RF_.board_.dshot_telemetry_read(i, &raw)
+        && DShot::decode_telemetry(raw, &erpm))
     {
-      write_servo(i, unsaturated_outputs_[i]);
+      motor_rpm_[i] = erpm * erpm_to_rpm_;
+      motor_telemetry_us_[i] = now_us;
     }
-    else if (mixer_to_use_->output_type[i] == M)
+  }
+}
+
+void Mixer::detect_motor_failure(uint64_t now_us, bool armed)
+{
+  if (!armed)
+  {
+    if (failed_motor_ != NO_FAILURE)
+    {
+      mixer_to_use_ = nominal_mixer_;
+      failed_motor_ = NO_FAILURE;
+    }
+    for (uint8_t i=0; i<NUM_OUTPUTS; i++)
+      motor_fault_start_us_[i] = 0;
+    return;
+  }
+
+  // Only a single failure can be handled, after that the reduced mixer is kept until disarm
+  if (failed_motor_ != NO_FAILURE || !RF_.params_.get_param_int(PARAM_MOTOR_FAILURE_DETECTION))
+    return;
+
+  // A motor has failed if it is being driven hard but isn't spinning, or has stopped talking
+  uint8_t num_faulted = 0;
+  uint8_t faulted_motor = NO_FAILURE;
+  for (uint8_t i=0; i<NUM_OUTPUTS; i++)
+  {
+    bool fault = failure_fit_index_[i] != NO_FAILURE
+                 && raw_outputs_[i] > FAILURE_MIN_OUTPUT
+                 && (now_us - motor_telemetry_us_[i] > FAILURE_TELEMETRY_TIMEOUT_US
+                     || motor_rpm_[i] < FAILURE_MIN_RPM);
+    if (!fault)
     {
-      // scale all motor outputs by scale factor (this is usually 1.0, unless we saturated)
-      unsaturated_outputs_[i] *= scale_factor;
-      write_motor(i, unsaturated_outputs_[i]);
+      motor_fault_start_us_[i] = 0;
+      continue;
     }
+
+    if (motor_fault_start_us_[i] == 0)
+      motor_fault_start_us_[i] = now_us;
+    if (now_us - motor_fault_start_us_[i] > FAILURE_DETECTION_TIME_US)
+    {
+      num_faulted++;
+      faulted_motor = i;
+    }
+  }
+
+  // Several motors dropping out at once is more likely a telemetry problem, and there is no
+  // mixer for it anyway
+  if (num_faulted == 1)
+  {
+    failed_motor_ = faulted_motor;
+    build_failure_mixing(faulted_motor);
+    mixer_to_use_ = &failure_mixing_;
+    RF_.mavlink_.log(Mavlink::LOG_CRITICAL, "Motor %d failed, mixing around it", faulted_motor + 1);
+  }
+}
+
+void Mixer::write_dshot(bool armed)
+{
+  // Anything that isn't an armed motor is sent the motor stop command
+  for (uint8_t i=0; i<NUM_OUTPUTS; i++)
+  {
+    uint16_t value = 0;
+    if (armed && mixer_to_use_->output_type[i] == M)
+      value = static_cast<uint16_t>(DShot::MIN_THROTTLE + raw_outputs_[i]*(DShot::MAX_THROTTLE - DShot::MIN_THROTTLE));
+    DShot::encode(DShot::frame(value, false, dshot_bidirectional_), dshot_bit_ticks_,
+                  &dshot_buffers_[i*DShot::BUFFER_LENGTH]);
   }
+  RF_.board_.dshot_write(dshot_buffers_, NUM_OUTPUTS);
 }
 
 }
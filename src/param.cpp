@@ -33,6 +33,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "board.h"
@@ -51,6 +52,28 @@ Params::Params(ROSflight& _rf) :
 {
   for (uint16_t id = 0; id < PARAMS_COUNT; id++)
     callbacks[id] = NULL;
+  table_hash_ = 0;
+  storage_bank_ = NO_BANK;
+  storage_sequence_ = 0;
+  journal_end_ = 0;
+  clear_dirty();
+}
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+  // CRC-32 (as used by zlib), half a byte at a time to keep the table small
+  static const uint32_t table[16] = { 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+                                      0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+                                      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                      0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = (crc >> 4) ^ table[(crc ^ bytes[i]) & 0x0F];
+    crc = (crc >> 4) ^ table[(crc ^ (bytes[i] >> 4)) & 0x0F];
+  }
+  return ~crc;
 }
 
 // local function definitions
@@ -59,6 +82,7 @@ void Params::init_param_int(uint16_t id, const char name[PARAMS_NAME_LENGTH], in
   memcpy(params.names[id], name, PARAMS_NAME_LENGTH);
   params.values[id].ivalue = value;
   params.types[id] = PARAM_TYPE_INT32;
+  set_dirty(id);
 }
 
 void Params::init_param_float(uint16_t id, const char name[PARAMS_NAME_LENGTH], float value)
@@ -66,33 +90,46 @@ void Params::init_param_float(uint16_t id, const char name[PARAMS_NAME_LENGTH],
   memcpy(params.names[id], name, PARAMS_NAME_LENGTH);
   params.values[id].fvalue = value;
   params.types[id] = PARAM_TYPE_FLOAT;
+  set_dirty(id);
 }
 
-uint8_t Params::compute_checksum(void)
+uint32_t Params::compute_table_hash(void)
 {
-  uint8_t chk = 0;
-  const char *p;
-
-  for (p = reinterpret_cast<const char *>(&params.values); p < reinterpret_cast<const char *>(&params.values) + 4*PARAMS_COUNT; p++)
-    chk ^= *p;
-  for (p = reinterpret_cast<const char *>(&params.names); p < reinterpret_cast<const char *>(&params.names) + PARAMS_COUNT*PARAMS_NAME_LENGTH; p++)
-    chk ^= *p;
-  for (p = reinterpret_cast<const char *>(&params.types); p < reinterpret_cast<const char *>(&params.types) + PARAMS_COUNT; p++)
-    chk ^= *p;
+  // FNV-1a over each name up to its terminator, then its type
+  uint32_t hash = 2166136261u;
+  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+  {
+    for (uint8_t i = 0; i < PARAMS_NAME_LENGTH && params.names[id][i] != '\0'; i++)
+      hash = (hash ^ static_cast<uint8_t>(params.names[id][i])) * 16777619u;
+    hash *= 16777619u; // the terminator
+    hash = (hash ^ static_cast<uint8_t>(params.types[id])) * 16777619u;
+  }
+  return hash;
+}
 
-  return chk;
+void Params::build_name_index(void)
+{
+  // Insertion sort, only done once at boot since the names are fixed for a given firmware
+  for (uint16_t i = 0; i < PARAMS_COUNT; i++)
+  {
+    uint16_t j = i;
+    for (; j > 0 && strncmp(params.names[name_index_[j - 1]], params.names[i], PARAMS_NAME_LENGTH) > 0; j--)
+      name_index_[j] = name_index_[j - 1];
+    name_index_[j] = static_cast<uint8_t>(i);
+  }
 }
 
 
 // function definitions
 void Params::init()
 {
+  // The names and types always come from the firmware, only the values are stored
   RF_.board_.memory_init();
+  set_defaults();
+  table_hash_ = compute_table_hash();
+  build_name_index();
   if (!read())
-  {
-    set_defaults();
     write();
-  }
 }
 
 void Params::set_defaults(void)
@@ -101,16 +138,21 @@ void Params::set_defaults(void)
   /*** HARDWARE CONFIGURATION ***/
   /******************************/
   init_param_int(PARAM_BAUD_RATE, "BAUD_RATE", 921600); // Baud rate of MAVlink communication with onboard computer | 9600 | 921600
+  init_param_int(PARAM_BLACKBOX, "BLACKBOX", 0); // Record every control loop to the onboard log (0: off, 1: while armed, 2: always) | 0 | 2
 
   /*****************************/
   /*** MAVLINK CONFIGURATION ***/
   /*****************************/
   init_param_int(PARAM_SYSTEM_ID, "SYS_ID", 1); // Mavlink System ID  | 1 | 255
+  init_param_int(PARAM_MAVLINK_VERSION, "MAVLINK_VER", 0); // MAVLink framing (0: MAVLink 1 until the onboard computer sends MAVLink 2, 1: MAVLink 1, 2: MAVLink 2) | 0 | 2
+  init_param_int(PARAM_LOG_BINARY, "LOG_BINARY", 0); // Send log messages as ROSFLIGHT_LOG format ids and raw arguments instead of text (see log-dictionary.json) | 0 | 1
+  init_param_int(PARAM_TIMESYNC_STAMP, "TIMESYNC_STAMP", 0); // Timestamp IMU and attitude messages in the onboard computer's time once the clock estimate has settled | 0 | 1
   init_param_int(PARAM_STREAM_HEARTBEAT_RATE, "STRM_HRTBT", 1); // Rate of heartbeat streaming (Hz) | 0 | 1000
   init_param_int(PARAM_STREAM_STATUS_RATE, "STRM_STATUS", 10); // Rate of status streaming (Hz) | 0 | 1000
 
   init_param_int(PARAM_STREAM_ATTITUDE_RATE, "STRM_ATTITUDE", 200); // Rate of attitude stream (Hz) | 0 | 1000
-  init_param_int(PARAM_STREAM_IMU_RATE, "STRM_IMU", 500); // Rate of IMU stream (Hz) | 0 | 1000
+  init_param_int(PARAM_STREAM_IMU_RATE, "STRM_IMU", 500); // Rate of IMU stream (Hz), rounded to send every Nth IMU sample | 0 | 1000
+  init_param_int(PARAM_STREAM_IMU_BATCH, "STRM_IMU_BATCH", 1); // Number of IMU samples per message (more than 1 sends ROSFLIGHT_IMU_BATCH instead of SMALL_IMU) | 1 | 8
   init_param_int(PARAM_STREAM_MAG_RATE, "STRM_MAG", 50); // Rate of magnetometer stream (Hz) | 0 | 75
   init_param_int(PARAM_STREAM_BARO_RATE, "STRM_BARO", 50); // Rate of barometer stream (Hz) | 0 | 100
   init_param_int(PARAM_STREAM_AIRSPEED_RATE, "STRM_AIRSPEED", 20); // Rate of airspeed stream (Hz) | 0 |  50
@@ -118,6 +160,7 @@ void Params::set_defaults(void)
 
   init_param_int(PARAM_STREAM_OUTPUT_RAW_RATE, "STRM_SERVO", 50); // Rate of raw output stream | 0 |  490
   init_param_int(PARAM_STREAM_RC_RAW_RATE, "STRM_RC", 50); // Rate of raw RC input stream | 0 | 50
+  init_param_int(PARAM_STREAM_TIMESYNC_RATE, "STRM_TIMESYNC", 10); // Rate of timesync requests used to estimate the onboard computer's clock (Hz) | 0 | 50
 
   /********************************/
   /*** CONTROLLER CONFIGURATION ***/
@@ -150,6 +193,38 @@ void Params::set_defaults(void)
 
   init_param_float(PARAM_PID_TAU, "PID_TAU", 0.05f); // Dirty Derivative time constant - See controller documentation | 0.0 | 1.0
 
+  init_param_int(PARAM_ATT_CONTROL_QUATERNION, "ATT_CTRL_QUAT", 0); // Angle mode uses quaternion attitude error instead of Euler angles (estimator skips Euler angle extraction) | 0 | 1
+
+  init_param_int(PARAM_GAIN_SCHEDULE, "GAIN_SCHED", 0); // Scale PID gains by throttle (multirotor) or airspeed (fixedwing) using the GS_* tables | 0 | 1
+  init_param_float(PARAM_GAIN_SCHEDULE_BP_0, "GS_BP_0", 0.0f); // Gain schedule breakpoint 0 (throttle 0-1, or airspeed m/s for fixedwing) | 0.0 | 100.0
+  init_param_float(PARAM_GAIN_SCHEDULE_BP_1, "GS_BP_1", 0.5f); // Gain schedule breakpoint 1 (throttle 0-1, or airspeed m/s for fixedwing) | 0.0 | 100.0
+  init_param_float(PARAM_GAIN_SCHEDULE_BP_2, "GS_BP_2", 1.0f); // Gain schedule breakpoint 2 (throttle 0-1, or airspeed m/s for fixedwing) | 0.0 | 100.0
+  init_param_float(PARAM_GAIN_SCHEDULE_ROLL_ANGLE_0, "GS_ROLL_ANG_0", 1.0f); // Roll angle PID gain multiplier at GS_BP_0 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_ROLL_ANGLE_1, "GS_ROLL_ANG_1", 1.0f); // Roll angle PID gain multiplier at GS_BP_1 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_ROLL_ANGLE_2, "GS_ROLL_ANG_2", 1.0f); // Roll angle PID gain multiplier at GS_BP_2 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_ROLL_RATE_0, "GS_ROLL_RATE_0", 1.0f); // Roll rate PID gain multiplier at GS_BP_0 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_ROLL_RATE_1, "GS_ROLL_RATE_1", 1.0f); // Roll rate PID gain multiplier at GS_BP_1 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_ROLL_RATE_2, "GS_ROLL_RATE_2", 1.0f); // Roll rate PID gain multiplier at GS_BP_2 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_PITCH_ANGLE_0, "GS_PITCH_ANG_0", 1.0f); // Pitch angle PID gain multiplier at GS_BP_0 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_PITCH_ANGLE_1, "GS_PITCH_ANG_1", 1.0f); // Pitch angle PID gain multiplier at GS_BP_1 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_PITCH_ANGLE_2, "GS_PITCH_ANG_2", 1.0f); // Pitch angle PID gain multiplier at GS_BP_2 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_PITCH_RATE_0, "GS_PITCH_RATE_0", 1.0f); // Pitch rate PID gain multiplier at GS_BP_0 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_PITCH_RATE_1, "GS_PITCH_RATE_1", 1.0f); // Pitch rate PID gain multiplier at GS_BP_1 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_PITCH_RATE_2, "GS_PITCH_RATE_2", 1.0f); // Pitch rate PID gain multiplier at GS_BP_2 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_YAW_RATE_0, "GS_YAW_RATE_0", 1.0f); // Yaw rate PID gain multiplier at GS_BP_0 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_YAW_RATE_1, "GS_YAW_RATE_1", 1.0f); // Yaw rate PID gain multiplier at GS_BP_1 | 0.0 | 10.0
+  init_param_float(PARAM_GAIN_SCHEDULE_YAW_RATE_2, "GS_YAW_RATE_2", 1.0f); // Yaw rate PID gain multiplier at GS_BP_2 | 0.0 | 10.0
+
+  init_param_float(PARAM_AUTOTUNE_RELAY, "ATUNE_RELAY", 0.05f); // Torque command amplitude of the autotune relay excitation | 0.0 | 1.0
+  init_param_float(PARAM_AUTOTUNE_HYSTERESIS, "ATUNE_HYST", 0.1f); // Autotune relay hysteresis on the rate error (rad/s) | 0.0 | 2.0
+  init_param_int(PARAM_AUTOTUNE_RULE, "ATUNE_RULE", 1); // Autotune gain rule (0: Ziegler-Nichols classic, 1: Ziegler-Nichols no overshoot, 2: PD only) | 0 | 2
+
+  init_param_int(PARAM_INDI, "INDI", 0); // Wrap the attitude and rate loops in incremental nonlinear dynamic inversion (multirotor only) | 0 | 1
+  init_param_float(PARAM_INDI_EFFECTIVENESS_ROLL, "INDI_G_ROLL", 100.0f); // Roll angular acceleration per unit torque command (rad/s^2) | 0.1 | 10000.0
+  init_param_float(PARAM_INDI_EFFECTIVENESS_PITCH, "INDI_G_PITCH", 100.0f); // Pitch angular acceleration per unit torque command (rad/s^2) | 0.1 | 10000.0
+  init_param_float(PARAM_INDI_EFFECTIVENESS_YAW, "INDI_G_YAW", 20.0f); // Yaw angular acceleration per unit torque command (rad/s^2) | 0.1 | 10000.0
+  init_param_float(PARAM_INDI_ALPHA, "INDI_ALPHA", 0.9f); // Low-pass filter constant applied to both angular acceleration and actuator feedback in INDI | 0.0 | 1.0
+
 
   /*************************/
   /*** PWM CONFIGURATION ***/
@@ -160,6 +235,14 @@ void Params::set_defaults(void)
   init_param_int(PARAM_MOTOR_MIN_PWM, "MOTOR_MIN_PWM", 1000); // PWM value sent to motor ESCs at zero throttle | 1000 | 2000
   init_param_int(PARAM_MOTOR_MAX_PWM, "MOTOR_MAX_PWM", 2000); // PWM value sent to motor ESCs at full throttle | 1000 | 2000
   init_param_int(PARAM_SPIN_MOTORS_WHEN_ARMED, "ARM_SPIN_MOTORS", true); // Enforce MOTOR_IDLE_THR | 0 | 1
+  init_param_int(PARAM_MIXER_AIRMODE, "MIX_AIRMODE", 0); // Allow the mixer to raise throttle to keep attitude authority at low throttle (active once throttle passes 0.1) | 0 | 1
+  init_param_int(PARAM_MOTOR_PROTOCOL, "MOTOR_PROTOCOL", 0); // Motor output protocol (0: PWM, 1: DShot150, 2: DShot300, 3: DShot600) | 0 | 3
+  init_param_int(PARAM_DSHOT_BIDIRECTIONAL, "DSHOT_BIDIR", 0); // Read eRPM telemetry back over the DShot signal wire | 0 | 1
+  init_param_int(PARAM_MOTOR_POLES, "MOTOR_POLES", 14); // Number of magnet poles in the motors, used to convert eRPM telemetry to RPM | 2 | 64
+  init_param_int(PARAM_MOTOR_FAILURE_DETECTION, "MOTOR_FAIL_DET", 0); // Mix around a single failed motor on 6 and 8 motor mixers (needs bidirectional DShot) | 0 | 1
+  init_param_float(PARAM_THRUST_EXPO, "THRUST_EXPO", 0.0f); // Shape of the motor thrust curve, thrust = (1 - expo)*throttle + expo*throttle^2 (0 for linear) | 0.0 | 1.0
+  init_param_float(PARAM_BATTERY_VOLTAGE_REFERENCE, "BATT_V_REF", 0.0f); // Battery voltage the motor outputs are scaled to as the battery sags (0 to disable) | 0.0 | 60.0
+  init_param_float(PARAM_BATTERY_VOLTAGE_ALPHA, "BATT_V_ALPHA", 0.99f); // Low-pass filter constant on the battery voltage measurement | 0.0 | 1.0
 
   /*******************************/
   /*** ESTIMATOR CONFIGURATION ***/
@@ -238,7 +321,25 @@ void Params::set_defaults(void)
   /***************************/
   /*** FRAME CONFIGURATION ***/
   /***************************/
-  init_param_int(PARAM_MIXER, "MIXER", Mixer::INVALID_MIXER); // Which mixer to choose - See Mixer documentation | 0 | 10
+  init_param_int(PARAM_MIXER, "MIXER", Mixer::INVALID_MIXER); // Which mixer to choose - See Mixer documentation | 0 | 11
+
+  init_param_int(PARAM_CUSTOM_MIXER_TYPES, "MIX_CUSTOM_TYPE", 0); // Custom mixer output types, 2 bits per output (0: none, 1: servo, 2: motor, 3: GPIO) - See Mixer documentation | 0 | 65535
+  init_param_int(PARAM_CUSTOM_MIXER_0_FX, "MIX_0_FX", 0); // Custom mixer output 0 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_0_YZ, "MIX_0_YZ", 0); // Custom mixer output 0 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_1_FX, "MIX_1_FX", 0); // Custom mixer output 1 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_1_YZ, "MIX_1_YZ", 0); // Custom mixer output 1 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_2_FX, "MIX_2_FX", 0); // Custom mixer output 2 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_2_YZ, "MIX_2_YZ", 0); // Custom mixer output 2 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_3_FX, "MIX_3_FX", 0); // Custom mixer output 3 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_3_YZ, "MIX_3_YZ", 0); // Custom mixer output 3 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_4_FX, "MIX_4_FX", 0); // Custom mixer output 4 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_4_YZ, "MIX_4_YZ", 0); // Custom mixer output 4 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_5_FX, "MIX_5_FX", 0); // Custom mixer output 5 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_5_YZ, "MIX_5_YZ", 0); // Custom mixer output 5 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_6_FX, "MIX_6_FX", 0); // Custom mixer output 6 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_6_YZ, "MIX_6_YZ", 0); // Custom mixer output 6 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_7_FX, "MIX_7_FX", 0); // Custom mixer output 7 F (high 16 bits) and x (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
+  init_param_int(PARAM_CUSTOM_MIXER_7_YZ, "MIX_7_YZ", 0); // Custom mixer output 7 y (high 16 bits) and z (low 16 bits) coefficients, Q2.13 fixed-point | -2147483648 | 2147483647
 
   init_param_int(PARAM_FIXED_WING, "FIXED_WING", false); // switches on passthrough commands for fixedwing operation | 0 | 1
   init_param_int(PARAM_ELEVATOR_REVERSE, "ELEVATOR_REV", 0); // reverses elevator servo output | 0 | 1
@@ -257,33 +358,134 @@ void Params::add_callback(std::function<void(int)> callback, uint16_t param_id)
   callback(param_id);
 }
 
+uint32_t Params::bank_size(void)
+{
+  return static_cast<uint32_t>(RF_.board_.memory_sector_size() * (RF_.board_.memory_sector_count() / 2));
+}
+
+void Params::clear_dirty(void)
+{
+  for (uint16_t i = 0; i < (PARAMS_COUNT + 31) / 32; i++)
+    dirty_[i] = 0;
+}
+
+bool Params::read_bank(uint8_t bank, storage_header_t *header)
+{
+  uint32_t start = bank * bank_size();
+  if (!RF_.board_.memory_read(start, header, sizeof(storage_header_t)))
+    return false;
+  if (header->magic != STORAGE_MAGIC || header->table_hash != table_hash_)
+    return false;
+
+  uint32_t crc = crc32(0, header, offsetof(storage_header_t, crc));
+  for (uint32_t offset = SNAPSHOT_OFFSET; offset < JOURNAL_OFFSET; offset += 32)
+  {
+    uint8_t chunk[32];
+    uint32_t len = (JOURNAL_OFFSET - offset < sizeof(chunk)) ? JOURNAL_OFFSET - offset : sizeof(chunk);
+    if (!RF_.board_.memory_read(start + offset, chunk, len))
+      return false;
+    crc = crc32(crc, chunk, len);
+  }
+  return crc == header->crc;
+}
+
 bool Params::read(void)
 {
-  if (!RF_.board_.memory_read(&params, sizeof(params_t)))
+  if (JOURNAL_OFFSET + sizeof(journal_record_t) > bank_size())
     return false;
 
-  if (params.version != GIT_VERSION_HASH)
+  // The newer of the two banks, if both are valid.  A bank whose snapshot wasn't finished is never
+  // valid, so the older one is still there if power was lost while writing it.
+  storage_header_t headers[2];
+  bool valid[2] = { read_bank(0, &headers[0]), read_bank(1, &headers[1]) };
+  if (!valid[0] && !valid[1])
+    return false;
+  uint8_t bank = (valid[0] && (!valid[1] || static_cast<int32_t>(headers[0].sequence - headers[1].sequence) > 0)) ? 0 : 1;
+  uint32_t start = bank * bank_size();
+  if (!RF_.board_.memory_read(start + SNAPSHOT_OFFSET, params.values, sizeof(params.values)))
     return false;
 
-  if (params.size != sizeof(params_t) || params.magic_be != 0xBE || params.magic_ef != 0xEF)
+  // Replay the journal up to the first erased record.  A record that doesn't check out (cut off
+  // by a power loss, for example) is skipped, and only costs that one change.
+  uint32_t offset = JOURNAL_OFFSET;
+  for (; offset + sizeof(journal_record_t) <= bank_size(); offset += sizeof(journal_record_t))
+  {
+    journal_record_t record;
+    if (!RF_.board_.memory_read(start + offset, &record, sizeof(record)))
+      return false;
+    if (record.id == 0xFFFFFFFF && record.value.ivalue == -1 && record.crc == 0xFFFFFFFF)
+      break;
+    if (record.id < PARAMS_COUNT && record.crc == crc32(0, &record, offsetof(journal_record_t, crc)))
+      params.values[record.id] = record.value;
+  }
+
+  storage_bank_ = bank;
+  storage_sequence_ = headers[bank].sequence;
+  journal_end_ = offset;
+  clear_dirty();
+  return true;
+}
+
+bool Params::write_snapshot(void)
+{
+  // Into the bank that isn't in use, with the header last so the bank only becomes valid once
+  // everything else is in place
+  uint8_t bank = (storage_bank_ == 0) ? 1 : 0;
+  uint8_t sectors = RF_.board_.memory_sector_count() / 2;
+  for (uint8_t i = 0; i < sectors; i++)
+  {
+    if (!RF_.board_.memory_erase(static_cast<uint8_t>(bank * sectors + i)))
+      return false;
+  }
+
+  uint32_t start = bank * bank_size();
+  if (!RF_.board_.memory_program(start + SNAPSHOT_OFFSET, params.values, sizeof(params.values)))
     return false;
 
-  if (compute_checksum() != params.chk)
+  storage_header_t header;
+  header.magic = STORAGE_MAGIC;
+  header.table_hash = table_hash_;
+  header.sequence = storage_sequence_ + 1;
+  header.crc = crc32(crc32(0, &header, offsetof(storage_header_t, crc)), params.values, sizeof(params.values));
+  if (!RF_.board_.memory_program(start, &header, sizeof(header)))
     return false;
 
+  storage_bank_ = bank;
+  storage_sequence_ = header.sequence;
+  journal_end_ = JOURNAL_OFFSET;
+  clear_dirty();
   return true;
 }
 
 bool Params::write(void)
 {
-  params.version = GIT_VERSION_HASH;
-  params.size = sizeof(params_t);
-  params.magic_be = 0xBE;
-  params.magic_ef = 0xEF;
-  params.chk = compute_checksum();
-
-  if (!RF_.board_.memory_write(&params, sizeof(params_t)))
+  if (JOURNAL_OFFSET + sizeof(journal_record_t) > bank_size())
     return false;
+
+  uint16_t changed = 0;
+  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+    changed += is_dirty(id);
+
+  // Only a full journal, or nothing to add to, takes a new snapshot and its sector erases
+  if (storage_bank_ == NO_BANK || journal_end_ + changed * sizeof(journal_record_t) > bank_size())
+    return write_snapshot();
+
+  uint32_t start = storage_bank_ * bank_size();
+  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+  {
+    if (!is_dirty(id))
+      continue;
+
+    journal_record_t record;
+    record.id = id;
+    record.value = params.values[id];
+    record.crc = crc32(0, &record, offsetof(journal_record_t, crc));
+    bool programmed = RF_.board_.memory_program(start + journal_end_, &record, sizeof(record));
+    journal_end_ += sizeof(journal_record_t);
+    if (!programmed)
+      return write_snapshot();
+    dirty_[id / 32] &= ~(1u << (id % 32));
+  }
   return true;
 }
 
@@ -296,25 +498,19 @@ void Params::change_callback(uint16_t id)
 
 uint16_t Params::lookup_param_id(const char name[PARAMS_NAME_LENGTH])
 {
-  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+  // Names are compared up to the terminator, or all PARAMS_NAME_LENGTH characters if there isn't one
+  uint16_t low = 0;
+  uint16_t high = PARAMS_COUNT;
+  while (low < high)
   {
-    bool match = true;
-    for (uint8_t i = 0; i < PARAMS_NAME_LENGTH; i++)
-    {
-      // compare each character
-      if (name[i] != params.names[id][i])
-      {
-        match = false;
-        break;
-      }
-
-      // stop comparing if end of string is reached
-      if (params.names[id][i] == '\0')
-        break;
-    }
-
-    if (match)
-      return id;
+    uint16_t mid = static_cast<uint16_t>((low + high) / 2);
+    int cmp = strncmp(params.names[name_index_[mid]], name, PARAMS_NAME_LENGTH);
+    if (cmp == 0)
+      return name_index_[mid];
+    else if (cmp < 0)
+      low = static_cast<uint16_t>(mid + 1);
+    else
+      high = mid;
   }
 
   return PARAMS_COUNT;
@@ -325,6 +521,7 @@ bool Params::set_param_int(uint16_t id, int32_t value)
   if (id < PARAMS_COUNT && value != params.values[id].ivalue)
   {
     params.values[id].ivalue = value;
+    set_dirty(id);
     change_callback(id);
     RF_.mavlink_.update_param(id);
     return true;
@@ -337,6 +534,7 @@ bool Params::set_param_float(uint16_t id, float value)
   if (id < PARAMS_COUNT && value != params.values[id].fvalue)
   {
     params.values[id].fvalue = value;
+    set_dirty(id);
     change_callback(id);
     RF_.mavlink_.update_param(id);
     return true;
@@ -104,27 +104,27 @@ void RC::init_switches()
 {
   for (uint8_t chan = 0; chan < static_cast<uint8_t>(SWITCHES_COUNT); chan++)
   {
-    char channel_name[18];
+    const char *channel_name;
     switch (chan)
     {
     case SWITCH_ARM:
-      strcpy(channel_name, "ARM");
+      channel_name = "ARM";
       switches[chan].channel = RF_.params_.get_param_int(PARAM_RC_ARM_CHANNEL);
       break;
     case SWITCH_ATT_OVERRIDE:
-      strcpy(channel_name, "ATTITUDE OVERRIDE");
+      channel_name = "ATTITUDE OVERRIDE";
       switches[chan].channel = RF_.params_.get_param_int(PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL);
       break;
     case SWITCH_THROTTLE_OVERRIDE:
-      strcpy(channel_name, "THROTTLE OVERRIDE");
+      channel_name = "THROTTLE OVERRIDE";
       switches[chan].channel = RF_.params_.get_param_int(PARAM_RC_THROTTLE_OVERRIDE_CHANNEL);
       break;
     case SWITCH_ATT_TYPE:
-      strcpy(channel_name, "ATTITUDE TYPE");
+      channel_name = "ATTITUDE TYPE";
       switches[chan].channel = RF_.params_.get_param_int(PARAM_RC_ATT_CONTROL_TYPE_CHANNEL);
       break;
     default:
-      strcpy(channel_name, "INVALID");
+      channel_name = "INVALID";
       switches[chan].channel = 255;
       break;
     }
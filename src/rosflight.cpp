@@ -44,7 +44,8 @@ ROSflight::ROSflight(Board& board) :
   mixer_(*this),
   rc_(*this),
   sensors_(*this),
-  state_manager_(*this)
+  state_manager_(*this),
+  logger_(*this)
 {
 }
 
@@ -88,6 +89,9 @@ void ROSflight::init()
 
   // Initialize the command muxer
   command_manager_.init();
+
+  // Initialize the blackbox log
+  logger_.init();
 }
 
 
@@ -104,6 +108,7 @@ void ROSflight::run()
     estimator_.run();
     controller_.run();
     mixer_.mix_output();
+    logger_.record();
     loop_time_us = board_.clock_micros() - start;
   }
 
@@ -124,6 +129,9 @@ void ROSflight::run()
 
   // update commands (internal logic tells whether or not we should do anything or not)
   command_manager_.run();
+
+  // hand a page of the blackbox log to the board, if one is full
+  logger_.run();
 }
 
 uint32_t ROSflight::get_loop_time_us()
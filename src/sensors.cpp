@@ -54,9 +54,12 @@ const int Sensors::SENSOR_CAL_CYCLES = 127;
 
 const float Sensors::BARO_MAX_CALIBRATION_VARIANCE = 25.0;   // standard dev about 0.2 m
 const float Sensors::DIFF_PRESSURE_MAX_CALIBRATION_VARIANCE = 100.0;   // standard dev about 3 m/s
+const float Sensors::BATTERY_MIN_VOLTAGE = 1.0f;   // anything lower means there is no battery monitor
+constexpr uint8_t Sensors::IMU_HISTORY_LENGTH;
 
 Sensors::Sensors(ROSflight& rosflight) :
-  rf_(rosflight)
+  rf_(rosflight),
+  imu_sample_count_(0)
 {}
 
 void Sensors::init()
@@ -153,6 +156,22 @@ void Sensors::update_other_sensors()
       correct_mag();
     }
     break;
+  case LowPrioritySensors::BATTERY:
+  {
+    float voltage = rf_.board_.battery_read();
+    bool present = voltage > BATTERY_MIN_VOLTAGE;
+    if (present && data_.battery_present)
+    {
+      float alpha = rf_.params_.get_param_float(PARAM_BATTERY_VOLTAGE_ALPHA);
+      data_.battery_voltage = alpha*data_.battery_voltage + (1.0f - alpha)*voltage;
+    }
+    else
+    {
+      data_.battery_voltage = voltage;
+    }
+    data_.battery_present = present;
+    break;
+  }
   default:
     break;
   }
@@ -252,6 +271,15 @@ bool Sensors::gyro_calibration_complete(void)
 
 //==================================================================
 // local function definitions
+bool Sensors::imu_sample(uint32_t sample_number, ImuSample *sample) const
+{
+  // Sample numbers count up from 0, the newest is imu_sample_count() - 1
+  if (sample_number >= imu_sample_count_ || imu_sample_count_ - sample_number > IMU_HISTORY_LENGTH)
+    return false;
+  *sample = imu_history_[sample_number % IMU_HISTORY_LENGTH];
+  return true;
+}
+
 bool Sensors::update_imu(void)
 {
   if (rf_.board_.new_imu_data())
@@ -277,6 +305,12 @@ bool Sensors::update_imu(void)
       calibrate_gyro();
 
     correct_imu();
+
+    ImuSample &sample = imu_history_[imu_sample_count_ % IMU_HISTORY_LENGTH];
+    sample.time_us = data_.imu_time;
+    sample.accel = data_.accel;
+    sample.gyro = data_.gyro;
+    imu_sample_count_++;
     return true;
   }
   else
@@ -0,0 +1,437 @@
+#include "common.h"
+#include "rosflight.h"
+#include "test_board.h"
+
+#include <deque>
+
+using namespace rosflight_firmware;
+
+namespace
+{
+
+// Fly from RC in rate mode with a unit rate limit and no gyro input, so the rate commands are
+// the stick positions and the rate errors are constant
+void setup_firmware(ROSflight& rf, testBoard& board)
+{
+  board.set_pwm_lost(false);
+  rf.init();
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::QUADCOPTER_X);
+  rf.params_.set_param_int(PARAM_RC_ATTITUDE_MODE, 0);
+  rf.params_.set_param_int(PARAM_RC_ARM_CHANNEL, 4);
+  rf.params_.set_param_float(PARAM_RC_MAX_ROLLRATE, 1.0f);
+  rf.params_.set_param_float(PARAM_RC_MAX_PITCHRATE, 1.0f);
+  rf.params_.set_param_float(PARAM_RC_MAX_YAWRATE, 1.0f);
+  rf.state_manager_.clear_error(rf.state_manager_.state().error_codes);
+}
+
+void fly(ROSflight& rf, testBoard& board, bool armed, float F, float x, uint32_t duration_us,
+         uint32_t imu_period_us = 1000)
+{
+  uint16_t rc_values[8] = { static_cast<uint16_t>(1500 + 500*x), 1500, static_cast<uint16_t>(1000 + 1000*F), 1500,
+                            static_cast<uint16_t>(armed ? 2000 : 1000), 1500, 1500, 1500 };
+  board.set_rc(rc_values);
+
+  float acc[3] = {0.0f, 0.0f, -9.80665f};
+  float gyro[3] = {0.0f, 0.0f, 0.0f};
+  uint64_t start_us = board.clock_micros();
+  while (board.clock_micros() < start_us + duration_us)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + imu_period_us);
+    rf.run();
+    rf.run(); // the other sensors are only read between IMU samples
+  }
+}
+
+} // namespace
+
+TEST(controller_test, tilt_error_zero_at_command)
+{
+  const float yaws[] = { -3.0f, -1.0f, 0.0f, 0.7f, 2.5f };
+  const float tilts[][2] = { { 0.5f, 0.5f }, { -0.8f, 0.3f }, { 1.2f, -0.6f }, { 0.0f, 0.0f } };
+  for (const float* tilt : tilts)
+  {
+    turbomath::Vector down_command = Controller::down_vector(tilt[0], tilt[1]);
+    for (float yaw : yaws)
+    {
+      turbomath::Vector error = Controller::tilt_error(turbomath::Quaternion(tilt[0], tilt[1], yaw), down_command);
+      EXPECT_NEAR(error.x, 0.0f, 1e-3);
+      EXPECT_NEAR(error.y, 0.0f, 1e-3);
+    }
+  }
+}
+
+TEST(controller_test, tilt_error_independent_of_yaw)
+{
+  turbomath::Vector down_command = Controller::down_vector(0.5f, 0.5f);
+  turbomath::Vector reference = Controller::tilt_error(turbomath::Quaternion(0.3f, 0.2f, 0.0f), down_command);
+  EXPECT_GT(reference.x, 0.1f);
+  EXPECT_GT(reference.y, 0.1f);
+  for (float yaw = -3.0f; yaw < 3.0f; yaw += 0.5f)
+  {
+    turbomath::Vector error = Controller::tilt_error(turbomath::Quaternion(0.3f, 0.2f, yaw), down_command);
+    EXPECT_NEAR(error.x, reference.x, 1e-3);
+    EXPECT_NEAR(error.y, reference.y, 1e-3);
+  }
+}
+
+TEST(controller_test, tilt_error_sign)
+{
+  turbomath::Quaternion level;
+
+  // Commanding a positive angle from level needs a positive torque on that axis
+  turbomath::Vector error = Controller::tilt_error(level, Controller::down_vector(0.2f, 0.0f));
+  EXPECT_NEAR(error.x, 2.0*sin(0.1), 1e-3);
+  EXPECT_NEAR(error.y, 0.0f, 1e-4);
+
+  error = Controller::tilt_error(level, Controller::down_vector(0.0f, 0.2f));
+  EXPECT_NEAR(error.x, 0.0f, 1e-4);
+  EXPECT_NEAR(error.y, 2.0*sin(0.1), 1e-3);
+
+  // and being past a level command needs a negative one
+  error = Controller::tilt_error(turbomath::Quaternion(-0.2f, 0.0f, 1.0f), Controller::down_vector(0.0f, 0.0f));
+  EXPECT_NEAR(error.x, 2.0*sin(0.1), 1e-3);
+  error = Controller::tilt_error(turbomath::Quaternion(0.0f, 0.2f, -1.0f), Controller::down_vector(0.0f, 0.0f));
+  EXPECT_NEAR(error.y, -2.0*sin(0.1), 1e-3);
+}
+
+TEST(controller_test, pid_integrates_in_seconds)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_P, 0.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_I, 1.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_D, 0.0f);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+
+  // A constant 0.5 rad/s error integrates to 0.1 over 0.2 s
+  fly(rf, board, true, 0.5f, 0.5f, 100000);
+  float start = rf.controller_.output().x;
+  fly(rf, board, true, 0.5f, 0.5f, 200000);
+  EXPECT_NEAR(rf.controller_.output().x - start, 0.1f, 1e-3);
+
+  // There is no integral term across gaps in the IMU data longer than 10 ms
+  fly(rf, board, true, 0.5f, 0.5f, 200000, 20000);
+  EXPECT_NEAR(rf.controller_.output().x, 0.0f, 1e-6);
+
+  // but the integrator picks up where it left off once they are back to normal
+  fly(rf, board, true, 0.5f, 0.5f, 100000);
+  EXPECT_NEAR(rf.controller_.output().x - start, 0.15f, 1e-3);
+}
+
+namespace
+{
+
+// Rate loop plant: the angular acceleration is the torque command, delayed, times a gain
+struct RatePlant
+{
+  RatePlant(float plant_gain, uint32_t delay_steps) : gain(plant_gain), rate(0.0f), torques(delay_steps, 0.0f) {}
+  float step(float torque, float dt)
+  {
+    torques.push_back(torque);
+    rate += gain*torques.front()*dt;
+    torques.pop_front();
+    return rate;
+  }
+  float gain;
+  float rate;
+  std::deque<float> torques;
+};
+
+void run_relay(Controller::RelayAutotune& relay, RatePlant& plant)
+{
+  float torque = 0.0f;
+  for (uint64_t t_us = 0; t_us < 10000000 && relay.status() == Controller::RelayAutotune::RUNNING; t_us += 1000)
+    torque = relay.run(t_us, plant.step(torque, 0.001f));
+}
+
+} // namespace
+
+TEST(controller_test, relay_autotune_finds_ultimate_point)
+{
+  // An integrator with a delay L has its ultimate period at 4L and its ultimate gain at
+  // pi/(2*K*L).  The relay measures the period exactly, and the gain to within the describing
+  // function approximation, which is 8/pi^2 of the true value for the triangle wave it makes.
+  const float K = 200.0f, d = 0.05f, L = 0.02f;
+  RatePlant plant(K, 20);
+  Controller::RelayAutotune relay;
+  relay.start(d, 0.0f, 0);
+  run_relay(relay, plant);
+  ASSERT_EQ(relay.status(), Controller::RelayAutotune::DONE);
+  EXPECT_NEAR(relay.ultimate_period(), 4.0f*L, 0.02f*4.0f*L);
+  float ku = M_PI/(2.0f*K*L);
+  EXPECT_NEAR(relay.ultimate_gain(), 8.0f/(M_PI*M_PI)*ku, 0.03f*ku);
+
+  // Hysteresis adds to both the amplitude and the period, and the describing function of a
+  // relay with hysteresis takes it back out of the gain
+  const float eps = 0.1f;
+  RatePlant hysteresis_plant(K, 20);
+  relay.start(d, eps, 0);
+  run_relay(relay, hysteresis_plant);
+  ASSERT_EQ(relay.status(), Controller::RelayAutotune::DONE);
+  float a = eps + K*d*L;
+  float tu = 4.0f*L + 4.0f*eps/(K*d);
+  EXPECT_NEAR(relay.ultimate_period(), tu, 0.05f*tu);
+  EXPECT_NEAR(relay.ultimate_gain(), 4.0f*d/(M_PI*sqrt(a*a - eps*eps)), 0.03f*ku);
+
+  // Without enough relay to overcome the hysteresis, there is no limit cycle
+  RatePlant stuck_plant(K, 20);
+  relay.start(d, 100.0f, 0);
+  run_relay(relay, stuck_plant);
+  EXPECT_EQ(relay.status(), Controller::RelayAutotune::FAILED);
+}
+
+TEST(controller_test, autotune_sets_ziegler_nichols_gains)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  rf.params_.set_param_float(PARAM_GYRO_ALPHA, 0.0f);
+  rf.params_.set_param_int(PARAM_AUTOTUNE_RULE, 0);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  fly(rf, board, true, 0.5f, 0.0f, 100000);
+  ASSERT_TRUE(rf.controller_.start_autotune());
+
+  // Close the rate loops on all three axes through the plant and the IMU
+  const float K = 200.0f;
+  RatePlant plants[3] = { RatePlant(K, 20), RatePlant(K, 20), RatePlant(K, 20) };
+  float acc[3] = {0.0f, 0.0f, -9.80665f};
+  for (int i = 0; i < 20000 && rf.controller_.autotune_active(); i++)
+  {
+    const Controller::Output& output = rf.controller_.output();
+    float gyro[3] = { plants[0].step(output.x, 0.001f), plants[1].step(output.y, 0.001f), plants[2].step(output.z, 0.001f) };
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+    rf.run();
+  }
+  ASSERT_FALSE(rf.controller_.autotune_active());
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+
+  // Classic Ziegler-Nichols: kp = 0.6 Ku, ki = 1.2 Ku/Tu, kd = 0.075 Ku*Tu.  The loop adds a
+  // sample of delay to the plant's, and the relay sees the rate error with its hysteresis.
+  const float d = rf.params_.get_param_float(PARAM_AUTOTUNE_RELAY);
+  const float eps = rf.params_.get_param_float(PARAM_AUTOTUNE_HYSTERESIS);
+  const float L = 0.021f;
+  float a = eps + K*d*L;
+  float ku = 4.0f*d/(M_PI*sqrt(a*a - eps*eps));
+  float tu = 4.0f*L + 4.0f*eps/(K*d);
+  const uint16_t gains[3][3] = {
+    { PARAM_PID_ROLL_RATE_P, PARAM_PID_ROLL_RATE_I, PARAM_PID_ROLL_RATE_D },
+    { PARAM_PID_PITCH_RATE_P, PARAM_PID_PITCH_RATE_I, PARAM_PID_PITCH_RATE_D },
+    { PARAM_PID_YAW_RATE_P, PARAM_PID_YAW_RATE_I, PARAM_PID_YAW_RATE_D }
+  };
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float kp = rf.params_.get_param_float(gains[axis][0]);
+    float ki = rf.params_.get_param_float(gains[axis][1]);
+    float kd = rf.params_.get_param_float(gains[axis][2]);
+    EXPECT_NEAR(kp, 0.6f*ku, 0.05f*0.6f*ku);
+    EXPECT_NEAR(ki, 1.2f*ku/tu, 0.05f*1.2f*ku/tu);
+    EXPECT_NEAR(kd, 0.075f*ku*tu, 0.05f*0.075f*ku*tu);
+  }
+}
+
+namespace
+{
+
+// Pack a row of a custom mixer into its pair of Q2.13 params
+void set_custom_mixer_row(ROSflight& rf, uint8_t output, float F, float x, float y, float z)
+{
+  auto q13 = [](float value) { return static_cast<uint32_t>(static_cast<uint16_t>(static_cast<int16_t>(value*8192.0f))); };
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_0_FX + 2*output, static_cast<int32_t>(q13(F) << 16 | q13(x)));
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_0_YZ + 2*output, static_cast<int32_t>(q13(y) << 16 | q13(z)));
+}
+
+void setup_indi(ROSflight& rf, testBoard& board)
+{
+  setup_firmware(rf, board);
+  rf.params_.set_param_int(PARAM_INDI, 1);
+  rf.params_.set_param_float(PARAM_INDI_ALPHA, 0.0f);
+  rf.params_.set_param_float(PARAM_GYRO_ALPHA, 0.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_P, 0.01f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_I, 0.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_D, 0.0f);
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_TYPES, 0xAA); // four motors
+}
+
+} // namespace
+
+TEST(controller_test, indi_increment_with_skewed_mixer)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_indi(rf, board);
+
+  // A quad X whose roll and yaw columns are neither orthogonal to each other nor to pitch
+  set_custom_mixer_row(rf, 0, 1.0f, -1.0f,  1.0f,  1.0f);
+  set_custom_mixer_row(rf, 1, 1.0f, -0.5f, -1.0f, -1.0f);
+  set_custom_mixer_row(rf, 2, 1.0f,  1.0f, -1.0f,  1.0f);
+  set_custom_mixer_row(rf, 3, 1.0f,  1.0f,  1.0f, -0.5f);
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::CUSTOM);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  fly(rf, board, true, 0.5f, 0.0f, 100000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+
+  // With no angular acceleration, each loop adds the PID output to the torque recovered from the
+  // previous mixer outputs, and none of it leaks onto the other axes
+  fly(rf, board, true, 0.5f, 0.2f, 100000);
+  for (int i = 0; i < 10; i++)
+  {
+    Controller::Output previous = rf.controller_.output();
+    fly(rf, board, true, 0.5f, 0.2f, 1000);
+    EXPECT_NEAR(rf.controller_.output().x - previous.x, 0.01f*0.2f, 1e-5);
+    EXPECT_NEAR(rf.controller_.output().y, 0.0f, 1e-5);
+    EXPECT_NEAR(rf.controller_.output().z, 0.0f, 1e-5);
+  }
+
+  // An angular acceleration takes its torque, per the effectiveness, back out of the increment
+  Controller::Output previous = rf.controller_.output();
+  float acc[3] = {0.0f, 0.0f, -9.80665f};
+  float gyro[3] = {0.01f, 0.0f, 0.0f};
+  board.set_imu(acc, gyro, board.clock_micros() + 1000);
+  rf.run();
+  rf.run();
+  float G = rf.params_.get_param_float(PARAM_INDI_EFFECTIVENESS_ROLL);
+  EXPECT_NEAR(rf.controller_.output().x - previous.x, 0.01f*(0.2f - 0.01f) - 10.0f/G, 1e-4);
+}
+
+TEST(controller_test, indi_refuses_dependent_mixer_columns)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_indi(rf, board);
+
+  // Roll and pitch can't be told apart from the outputs, so the PID output is used as is
+  set_custom_mixer_row(rf, 0, 1.0f, -1.0f, -1.0f,  1.0f);
+  set_custom_mixer_row(rf, 1, 1.0f, -1.0f, -1.0f, -1.0f);
+  set_custom_mixer_row(rf, 2, 1.0f,  1.0f,  1.0f,  1.0f);
+  set_custom_mixer_row(rf, 3, 1.0f,  1.0f,  1.0f, -1.0f);
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::CUSTOM);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  fly(rf, board, true, 0.5f, 0.2f, 200000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+  EXPECT_NEAR(rf.controller_.output().x, 0.01f*0.2f, 1e-5);
+}
+
+TEST(controller_test, indi_refuses_nonpositive_effectiveness)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_indi(rf, board);
+  rf.params_.set_param_float(PARAM_INDI_EFFECTIVENESS_PITCH, 0.0f);
+
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::QUADCOPTER_X);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  fly(rf, board, true, 0.5f, 0.2f, 200000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+  EXPECT_NEAR(rf.controller_.output().x, 0.01f*0.2f, 1e-5);
+  EXPECT_NEAR(rf.controller_.output().y, 0.0f, 1e-5);
+}
+
+namespace
+{
+
+// Roll rate gain multiplier expected from the GS_ROLL_RATE table at x
+float scheduled_gain(const float breakpoints[3], const float table[3], float x)
+{
+  if (x <= breakpoints[0])
+    return table[0];
+  if (x >= breakpoints[2])
+    return table[2];
+  int i = (x > breakpoints[1]) ? 1 : 0;
+  return table[i] + (x - breakpoints[i]) / (breakpoints[i + 1] - breakpoints[i]) * (table[i + 1] - table[i]);
+}
+
+void setup_gain_schedule(ROSflight& rf, const float breakpoints[3], const float table[3])
+{
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_P, 1.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_I, 0.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_D, 0.0f);
+  rf.params_.set_param_int(PARAM_GAIN_SCHEDULE, 1);
+  for (int i = 0; i < 3; i++)
+  {
+    rf.params_.set_param_float(PARAM_GAIN_SCHEDULE_BP_0 + i, breakpoints[i]);
+    rf.params_.set_param_float(PARAM_GAIN_SCHEDULE_ROLL_RATE_0 + i, table[i]);
+  }
+}
+
+} // namespace
+
+TEST(controller_test, gain_schedule_on_throttle)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  const float breakpoints[3] = { 0.2f, 0.5f, 0.8f };
+  const float table[3] = { 0.5f, 1.0f, 3.0f };
+  setup_gain_schedule(rf, breakpoints, table);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+
+  // The roll rate gain is held outside the breakpoints and interpolated between them, and the
+  // other loops keep their own tables
+  const float throttles[] = { 0.1f, 0.2f, 0.35f, 0.5f, 0.65f, 0.8f, 0.95f };
+  for (float F : throttles)
+  {
+    fly(rf, board, true, F, 0.2f, 100000);
+    float expected = scheduled_gain(breakpoints, table, rf.command_manager_.combined_control().F.value);
+    EXPECT_NEAR(rf.controller_.output().x, 0.2f*expected, 1e-3) << "throttle " << F;
+  }
+  fly(rf, board, true, 0.5f, 0.2f, 100000);
+  EXPECT_NEAR(rf.controller_.output().x, 0.2f*table[1], 1e-3);
+  fly(rf, board, true, 0.9f, 0.2f, 100000);
+  EXPECT_NEAR(rf.controller_.output().x, 0.2f*table[2], 1e-3);
+
+  // and the gains are back to normal with the schedule off
+  rf.params_.set_param_int(PARAM_GAIN_SCHEDULE, 0);
+  fly(rf, board, true, 0.9f, 0.2f, 100000);
+  EXPECT_NEAR(rf.controller_.output().x, 0.2f, 1e-3);
+}
+
+TEST(controller_test, gain_schedule_on_airspeed_for_fixedwing)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  rf.params_.set_param_int(PARAM_FIXED_WING, 1);
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::FIXEDWING);
+  rf.params_.set_param_int(PARAM_RC_OVERRIDE_TAKE_MIN_THROTTLE, 0);
+  rf.params_.set_param_int(PARAM_RC_ATTITUDE_OVERRIDE_CHANNEL, -1);
+  rf.params_.set_param_int(PARAM_RC_THROTTLE_OVERRIDE_CHANNEL, -1);
+  const float breakpoints[3] = { 10.0f, 20.0f, 30.0f };
+  const float table[3] = { 0.5f, 1.0f, 3.0f };
+  setup_gain_schedule(rf, breakpoints, table);
+
+  // The airspeed sensor is found and calibrated at zero while disarmed
+  const float temperature = 288.15f;
+  board.set_diff_pressure(0.0f, temperature);
+  fly(rf, board, false, 0.0f, 0.0f, 7000000);
+  fly(rf, board, true, 0.0f, 0.0f, 100000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+
+  // Fly a roll rate from offboard at nearly full throttle, so the throttle alone would give the
+  // last breakpoint's gain
+  const float airspeeds[] = { 5.0f, 15.0f, 25.0f, 35.0f };
+  for (float airspeed : airspeeds)
+  {
+    board.set_diff_pressure(airspeed*airspeed*101325.0f/(24.574f*24.574f*temperature), temperature);
+    float acc[3] = {0.0f, 0.0f, -9.80665f};
+    float gyro[3] = {0.0f, 0.0f, 0.0f};
+    uint64_t start_us = board.clock_micros();
+    while (board.clock_micros() < start_us + 2000000)
+    {
+      control_t command = { board.clock_millis(), { true, RATE, 0.2f }, { true, PASSTHROUGH, 0.0f },
+                            { true, PASSTHROUGH, 0.0f }, { true, THROTTLE, 0.9f } };
+      rf.command_manager_.set_new_offboard_command(command);
+      board.set_imu(acc, gyro, board.clock_micros() + 1000);
+      rf.run();
+      rf.run();
+    }
+    float measured = rf.sensors_.data().diff_pressure_velocity;
+    ASSERT_NEAR(measured, airspeed, 0.1f*airspeed);
+    EXPECT_NEAR(rf.command_manager_.combined_control().F.value, 0.9f, 1e-6);
+    EXPECT_NEAR(rf.controller_.output().x, 0.2f*scheduled_gain(breakpoints, table, measured), 1e-3)
+        << "airspeed " << airspeed;
+  }
+}
@@ -0,0 +1,182 @@
+#include <gtest/gtest.h>
+#include "test_board.h"
+#include "rosflight.h"
+#include "dshot.h"
+
+using namespace rosflight_firmware;
+
+// Read a frame back out of a buffer of timer compare values
+uint16_t decode_buffer(const uint16_t *buffer, uint16_t bit_ticks)
+{
+  uint16_t frame = 0;
+  for (int i = 0; i < DShot::FRAME_BITS; i++)
+    frame = (frame << 1) | (buffer[i] > bit_ticks / 2 ? 1 : 0);
+  return frame;
+}
+
+// Build the telemetry word an ESC would send for a given eRPM period
+uint32_t encode_telemetry(uint16_t exponent, uint16_t mantissa, bool corrupt)
+{
+  static const uint8_t gcr_encode[16] = { 0x19, 0x1B, 0x12, 0x13, 0x1D, 0x15, 0x16, 0x17,
+                                          0x1A, 0x09, 0x0A, 0x0B, 0x1E, 0x0D, 0x0E, 0x0F };
+  uint16_t value = (exponent << 13) | (mantissa << 4);
+  uint16_t csum = 0x0F ^ ((value >> 4) & 0x0F) ^ ((value >> 8) & 0x0F) ^ ((value >> 12) & 0x0F);
+  value |= corrupt ? (csum ^ 0x01) : csum;
+
+  uint32_t gcr = 0;
+  for (int i = 0; i < 4; i++)
+    gcr |= gcr_encode[(value >> (4*i)) & 0x0F] << (5*i);
+
+  // A one is sent as a transition, starting from the start bit
+  uint32_t raw = 1 << 20;
+  for (int i = 19; i >= 0; i--)
+    raw |= (((gcr >> i) ^ (raw >> (i + 1))) & 1) << i;
+  return raw;
+}
+
+TEST(dshot_test, frame_crc)
+{
+  // throttle 1046 without telemetry is the usual worked example
+  EXPECT_EQ(DShot::frame(1046, false, false), 0x82C6);
+  EXPECT_EQ(DShot::frame(1046, true, false), 0x82D7);
+  // bidirectional DShot inverts the CRC
+  EXPECT_EQ(DShot::frame(1046, false, true), 0x82C9);
+  EXPECT_EQ(DShot::frame(0, false, false), 0x0000);
+}
+
+TEST(dshot_test, encode)
+{
+  uint16_t buffer[DShot::BUFFER_LENGTH];
+  uint16_t ticks = 120; // DShot600 at 72 MHz
+  DShot::encode(0x82C6, ticks, buffer);
+  EXPECT_EQ(buffer[0], 90);
+  EXPECT_EQ(buffer[1], 45);
+  EXPECT_EQ(buffer[DShot::FRAME_BITS], 0);
+  EXPECT_EQ(buffer[DShot::FRAME_BITS + 1], 0);
+  EXPECT_EQ(decode_buffer(buffer, ticks), 0x82C6);
+}
+
+TEST(dshot_test, decode_telemetry)
+{
+  uint32_t erpm = 1;
+
+  // 100 << 2 = 400 us per electrical revolution
+  EXPECT_TRUE(DShot::decode_telemetry(encode_telemetry(2, 100, false), &erpm));
+  EXPECT_EQ(erpm, 150000);
+
+  EXPECT_TRUE(DShot::decode_telemetry(encode_telemetry(0, 511, false), &erpm));
+  EXPECT_EQ(erpm, 60000000 / 511);
+
+  // stopped motor
+  EXPECT_TRUE(DShot::decode_telemetry(encode_telemetry(7, 511, false), &erpm));
+  EXPECT_EQ(erpm, 0);
+
+  EXPECT_FALSE(DShot::decode_telemetry(encode_telemetry(2, 100, true), &erpm));
+  EXPECT_FALSE(DShot::decode_telemetry(0, &erpm));
+}
+
+TEST(dshot_test, mixer_output)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::QUADCOPTER_X);
+  rf.params_.set_param_int(PARAM_MOTOR_PROTOCOL, DShot::PROTOCOL_DSHOT600);
+  rf.params_.set_param_int(PARAM_DSHOT_BIDIRECTIONAL, 1);
+  EXPECT_EQ(board.dshot_bit_ticks(), 120);
+
+  // 14 pole motors, so 7 electrical revolutions per mechanical revolution
+  board.set_dshot_telemetry(0, encode_telemetry(2, 100, false));
+
+  float acc[3] = {0, 0, -9.80665f};
+  float gyro[3] = {0, 0, 0};
+  for (int i = 0; i < 10; i++)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+  }
+
+  // Disarmed, so every channel is sent motor stop
+  for (int i = 0; i < 8; i++)
+    EXPECT_EQ(decode_buffer(board.dshot_buffer(i), board.dshot_bit_ticks()), DShot::frame(0, false, true));
+
+  EXPECT_NEAR(rf.mixer_.get_motor_rpm()[0], 150000.0f / 7.0f, 0.1f);
+  EXPECT_EQ(rf.mixer_.get_motor_rpm()[1], 0.0f);
+}
+
+void run_for(ROSflight& rf, testBoard& board, uint32_t us)
+{
+  uint64_t start_time_us = board.clock_micros();
+  float acc[3] = {0, 0, -9.80665f};
+  float gyro[3] = {0, 0, 0};
+  while (board.clock_micros() < start_time_us + us)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+  }
+}
+
+TEST(dshot_test, motor_failure)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::HEX_X);
+  rf.params_.set_param_int(PARAM_MOTOR_PROTOCOL, DShot::PROTOCOL_DSHOT600);
+  rf.params_.set_param_int(PARAM_DSHOT_BIDIRECTIONAL, 1);
+  rf.params_.set_param_int(PARAM_MOTOR_FAILURE_DETECTION, 1);
+  for (int i = 0; i < 6; i++)
+    board.set_dshot_telemetry(i, encode_telemetry(2, 100, false));
+
+  // Arm, then bring the throttle up
+  uint16_t rc_values[8] = {1500, 1500, 1000, 2000, 1000, 1000, 1000, 1000};
+  board.set_rc(rc_values);
+  run_for(rf, board, 20000);
+  rf.state_manager_.clear_error(rf.state_manager_.state().error_codes);
+  run_for(rf, board, 1100000);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+  rc_values[2] = 1600;
+  rc_values[3] = 1500;
+  board.set_rc(rc_values);
+  run_for(rf, board, 300000);
+  EXPECT_EQ(rf.mixer_.get_failed_motor(), Mixer::NO_FAILURE);
+
+  // Motor 1 stops, and is mixed out once it has been stopped long enough
+  board.set_dshot_telemetry(0, encode_telemetry(7, 511, false));
+  run_for(rf, board, 100000);
+  EXPECT_EQ(rf.mixer_.get_failed_motor(), Mixer::NO_FAILURE);
+  run_for(rf, board, 200000);
+  EXPECT_EQ(rf.mixer_.get_failed_motor(), 0);
+
+  // The rest of the motors still produce the commanded thrust and torques
+  const Mixer::mixer_t *mixer = rf.mixer_.get_mixer();
+  const float *columns[4] = { mixer->F, mixer->x, mixer->y, mixer->z };
+  for (int j = 0; j < 4; j++)
+    EXPECT_EQ(columns[j][0], 0.0f);
+  float hex_x[4][6] = {{ 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f},
+                       {-0.5f, -1.0f, -0.5f, 0.5f, 1.0f, 0.5f},
+                       { 0.866025f, 0.0f, -0.866025f, -0.866025f, 0.0f, 0.866025f},
+                       { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f}};
+  float norm[4] = {6.0f, 3.0f, 3.0f, 6.0f};
+  for (int l = 0; l < 4; l++)
+  {
+    for (int j = 0; j < 4; j++)
+    {
+      float effect = 0.0f;
+      for (int i = 0; i < 6; i++)
+        effect += hex_x[l][i] * columns[j][i] / norm[l];
+      EXPECT_NEAR(effect, l == j ? 1.0f : 0.0f, 1e-3f);
+    }
+  }
+
+  // Disarming brings back the full mixer
+  rc_values[2] = 1000;
+  rc_values[3] = 1000;
+  board.set_rc(rc_values);
+  run_for(rf, board, 1100000);
+  EXPECT_FALSE(rf.state_manager_.state().armed);
+  EXPECT_EQ(rf.mixer_.get_failed_motor(), Mixer::NO_FAILURE);
+  EXPECT_EQ(rf.mixer_.get_mixer()->F[0], 1.0f);
+}
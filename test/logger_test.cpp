@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "test_board.h"
+#include "rosflight.h"
+
+using namespace rosflight_firmware;
+
+uint64_t read_varint(const std::vector<uint8_t> &data, size_t *i)
+{
+  uint64_t value = 0;
+  for (int shift = 0; ; shift += 7)
+  {
+    uint8_t byte = data[(*i)++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (byte < 0x80)
+      return value;
+  }
+}
+
+// Decode every record in the log, the same way blackbox_decode.py does
+std::vector<std::vector<int64_t>> decode_log(const std::vector<uint8_t> &data)
+{
+  std::vector<std::vector<int64_t>> records;
+  for (size_t start = 0; start + Logger::PAGE_SIZE <= data.size(); start += Logger::PAGE_SIZE)
+  {
+    EXPECT_EQ(data[start], 0xB5);
+    EXPECT_EQ(data[start + 4], ROSFLIGHT_NUM_OUTPUTS);
+    EXPECT_EQ(data[start + 2] | (data[start + 3] << 8), start / Logger::PAGE_SIZE);
+    EXPECT_EQ(data[start + Logger::PAGE_HEADER_LEN], 1);
+
+    size_t i = start + Logger::PAGE_HEADER_LEN;
+    std::vector<int64_t> values(1 + Logger::FIELD_COUNT, 0);
+    while (i < start + Logger::PAGE_SIZE && data[i] != Logger::RECORD_END)
+    {
+      bool key_frame = data[i++] == Logger::RECORD_KEY_FRAME;
+      uint64_t time_us = read_varint(data, &i);
+      values[0] = key_frame ? time_us : values[0] + time_us;
+      for (int n = 1; n <= Logger::FIELD_COUNT; n++)
+      {
+        uint32_t zigzag = static_cast<uint32_t>(read_varint(data, &i));
+        int32_t value = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+        values[n] = key_frame ? value : static_cast<int32_t>(static_cast<uint32_t>(values[n]) + value);
+      }
+      records.push_back(values);
+    }
+    EXPECT_LE(i, start + Logger::PAGE_SIZE);
+  }
+  return records;
+}
+
+TEST(logger_test, records_every_loop)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  rf.params_.set_param_int(PARAM_BLACKBOX, Logger::LOG_ALWAYS);
+
+  float acc[3] = {0, 0, -9.80665f};
+  float gyro[3] = {0, 0, 0};
+  for (int i = 0; i < 2000; i++)
+  {
+    acc[0] = 0.001f * (i % 100);
+    gyro[2] = -0.0001f * i;
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+  }
+
+  // Every loop is there, in order, except for the ones still in RAM
+  std::vector<std::vector<int64_t>> records = decode_log(board.log_data());
+  ASSERT_GT(records.size(), 1900u);
+  EXPECT_EQ(rf.logger_.records_dropped(), 0u);
+  for (size_t i = 1; i < records.size(); i++)
+    EXPECT_EQ(records[i][0] - records[i - 1][0], 1000);
+
+  // The last logged loop matches the state it recorded
+  const std::vector<int64_t> &last = records.back();
+  EXPECT_NEAR(last[1 + Logger::FIELD_GYRO_Z] / 1e4, -0.0001 * (records.size() - 1), 1e-3);
+  double norm = 0;
+  for (int n = Logger::FIELD_ATTITUDE_W; n <= Logger::FIELD_ATTITUDE_Z; n++)
+    norm += last[1 + n] * last[1 + n] / 1e8;
+  EXPECT_NEAR(norm, 1.0, 1e-3);
+  EXPECT_EQ(last[1 + Logger::FIELD_OUTPUTS], static_cast<int64_t>(rf.mixer_.get_outputs()[0] * 1e4f + 0.5f));
+
+  // Steady values compress to a byte or so per field
+  EXPECT_LT(board.log_data().size() / static_cast<double>(records.size()), 1.5 * (2 + Logger::FIELD_COUNT));
+}
+
+TEST(logger_test, armed_only_and_full)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  // Nothing is recorded while disarmed
+  float acc[3] = {0, 0, -9.80665f};
+  float gyro[3] = {0, 0, 0};
+  rf.params_.set_param_int(PARAM_BLACKBOX, Logger::LOG_ARMED);
+  for (int i = 0; i < 500; i++)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+  }
+  EXPECT_TRUE(board.log_data().empty());
+
+  // Recording stops once the log is full
+  board.set_log_capacity(4*Logger::PAGE_SIZE);
+  rf.params_.set_param_int(PARAM_BLACKBOX, Logger::LOG_ALWAYS);
+  for (int i = 0; i < 2000; i++)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+  }
+  EXPECT_EQ(board.log_data().size(), 4u*Logger::PAGE_SIZE);
+  EXPECT_EQ(rf.logger_.pages_written(), 4u);
+}
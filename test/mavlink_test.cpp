@@ -0,0 +1,459 @@
+#include <gtest/gtest.h>
+#include "test_board.h"
+#include "rosflight.h"
+
+using namespace rosflight_firmware;
+
+void run_firmware(ROSflight& rf, testBoard& board, uint32_t us)
+{
+  uint64_t start_time_us = board.clock_micros();
+  float acc[3] = {0, 0, -9.80665f};
+  float gyro[3] = {0, 0, 0};
+  while (board.clock_micros() < start_time_us + us)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+  }
+}
+
+TEST(mavlink_test, stream_bandwidth)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  // Ask for far more than a 9600 baud link can carry
+  rf.params_.set_param_int(PARAM_BAUD_RATE, 9600);
+  rf.params_.set_param_int(PARAM_STREAM_IMU_RATE, 1000);
+  rf.params_.set_param_int(PARAM_STREAM_ATTITUDE_RATE, 200);
+  rf.mavlink_.init();
+
+  uint16_t rc_values[8] = {1500, 1500, 1000, 1500, 1000, 1000, 1000, 1000};
+  board.set_rc(rc_values);
+  run_firmware(rf, board, 100000);
+  rf.state_manager_.clear_error(rf.state_manager_.state().error_codes);
+
+  size_t start_bytes = board.serial_tx_bytes();
+  run_firmware(rf, board, 2000000);
+
+  // The streams are held to the link rate, so nothing is queued faster than it can be sent
+  // and nothing is dropped
+  size_t sent = board.serial_tx_bytes() - start_bytes;
+  EXPECT_LE(sent, 2*960 + 512);
+  EXPECT_GT(sent, 2*960/2);
+  EXPECT_EQ(rf.mavlink_.tx_dropped_messages(), 0);
+}
+
+TEST(mavlink_test, imu_history)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  run_firmware(rf, board, 100000);
+
+  uint32_t count = rf.sensors_.imu_sample_count();
+  ASSERT_GT(count, Sensors::IMU_HISTORY_LENGTH);
+
+  Sensors::ImuSample newest, oldest, sample;
+  EXPECT_TRUE(rf.sensors_.imu_sample(count - 1, &newest));
+  EXPECT_EQ(newest.time_us, rf.sensors_.data().imu_time);
+  EXPECT_TRUE(rf.sensors_.imu_sample(count - Sensors::IMU_HISTORY_LENGTH, &oldest));
+  EXPECT_EQ(newest.time_us - oldest.time_us, 1000u * (Sensors::IMU_HISTORY_LENGTH - 1));
+
+  // Overwritten, and not read yet
+  EXPECT_FALSE(rf.sensors_.imu_sample(count - Sensors::IMU_HISTORY_LENGTH - 1, &sample));
+  EXPECT_FALSE(rf.sensors_.imu_sample(count, &sample));
+}
+
+TEST(mavlink_test, imu_batch_pack)
+{
+  uint16_t dt_us[8] = {0, 1000, 2000, 3000, 0, 0, 0, 0};
+  int16_t accel[24] = {1, 2, 3};
+  int16_t gyro[24] = {-1, -2, -3};
+  mavlink_message_t msg;
+  mavlink_msg_rosflight_imu_batch_pack(1, 250, &msg, 123456789, 0.5f, 0.25f, 30.0f, dt_us, accel, gyro, 4);
+
+  const uint8_t *payload = reinterpret_cast<const uint8_t *>(msg.payload64);
+  uint64_t time_usec;
+  memcpy(&time_usec, payload, sizeof(time_usec));
+  EXPECT_EQ(time_usec, 123456789u);
+  EXPECT_EQ(payload[20 + 2] | (payload[20 + 3] << 8), 1000);
+  EXPECT_EQ(payload[36 + 4], 3);
+  EXPECT_EQ(payload[84], 0xFF);
+  EXPECT_EQ(payload[132], 4);
+  EXPECT_EQ(msg.msgid, MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH);
+}
+
+uint16_t mavlink2_checksum(const uint8_t *frame, uint8_t crc_extra)
+{
+  uint16_t checksum;
+  crc_init(&checksum);
+  crc_accumulate_buffer(&checksum, reinterpret_cast<const char *>(&frame[1]), 9 + frame[1]);
+  crc_accumulate(crc_extra, &checksum);
+  return checksum;
+}
+
+TEST(mavlink_test, mavlink2_framing)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  rf.params_.set_param_int(PARAM_MAVLINK_VERSION, Mavlink::MAVLINK_VERSION_2);
+  rf.params_.set_param_int(PARAM_STREAM_IMU_BATCH, 4);
+  board.clear_serial_tx_data();
+  run_firmware(rf, board, 100000);
+
+  // Every frame is MAVLink 2 with a valid checksum, and the batches aren't truncated since
+  // they end in the sample count
+  const std::vector<uint8_t> &data = board.serial_tx_data();
+  size_t i = 0;
+  int batches = 0;
+  while (i < data.size())
+  {
+    ASSERT_EQ(data[i], 0xFD);
+    ASSERT_LE(i + 12 + data[i + 1], data.size());
+    uint32_t msgid = data[i + 7] | (data[i + 8] << 8) | (data[i + 9] << 16);
+    if (msgid == MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH)
+    {
+      EXPECT_EQ(data[i + 1], MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_LEN);
+      EXPECT_EQ(mavlink2_checksum(&data[i], MAVLINK_MSG_ID_ROSFLIGHT_IMU_BATCH_CRC),
+                data[i + 10 + data[i + 1]] | (data[i + 11 + data[i + 1]] << 8));
+      batches++;
+    }
+    i += 12 + data[i + 1];
+  }
+  EXPECT_GT(batches, 0);
+}
+
+TEST(mavlink_test, mavlink2_negotiation)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  run_firmware(rf, board, 10000);
+  EXPECT_FALSE(rf.mavlink_.mavlink2());
+  EXPECT_EQ(board.serial_tx_data()[0], MAVLINK_STX);
+
+  // A heartbeat, truncated to its first byte
+  uint8_t frame[13] = {0xFD, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0};
+  uint16_t checksum = mavlink2_checksum(frame, 50);
+  frame[11] = static_cast<uint8_t>(checksum & 0xFF);
+  frame[12] = static_cast<uint8_t>(checksum >> 8);
+
+  // A corrupted frame is ignored
+  frame[12] ^= 1;
+  board.set_serial_rx(frame, sizeof(frame));
+  run_firmware(rf, board, 10000);
+  EXPECT_FALSE(rf.mavlink_.mavlink2());
+
+  frame[12] ^= 1;
+  board.set_serial_rx(frame, sizeof(frame));
+  run_firmware(rf, board, 10000);
+  EXPECT_TRUE(rf.mavlink_.mavlink2());
+  board.clear_serial_tx_data();
+  run_firmware(rf, board, 10000);
+  EXPECT_EQ(board.serial_tx_data()[0], 0xFD);
+
+  // Forcing MAVLink 1 stops it again
+  rf.params_.set_param_int(PARAM_MAVLINK_VERSION, Mavlink::MAVLINK_VERSION_1);
+  EXPECT_FALSE(rf.mavlink_.mavlink2());
+}
+
+TEST(mavlink_test, receive_budget)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  // More than one call may parse is left for the next one, and counted
+  uint8_t data[600] = {};
+  board.set_serial_rx(data, sizeof(data));
+  rf.mavlink_.receive();
+  EXPECT_EQ(board.serial_bytes_available(), 600 - 256);
+  EXPECT_EQ(rf.mavlink_.rx_budget_overruns(), 1u);
+  rf.mavlink_.receive();
+  rf.mavlink_.receive();
+  EXPECT_EQ(board.serial_bytes_available(), 0);
+  EXPECT_EQ(rf.mavlink_.rx_budget_overruns(), 2u);
+}
+
+std::vector<uint8_t> mavlink2_frame(uint8_t msgid, const uint8_t *payload, uint8_t length, uint8_t crc_extra)
+{
+  std::vector<uint8_t> frame = {0xFD, length, 0, 0, 0, 1, 0, msgid, 0, 0};
+  frame.insert(frame.end(), payload, payload + length);
+  uint16_t checksum = mavlink2_checksum(frame.data(), crc_extra);
+  frame.push_back(static_cast<uint8_t>(checksum & 0xFF));
+  frame.push_back(static_cast<uint8_t>(checksum >> 8));
+  return frame;
+}
+
+// Put the blob back together from the chunks in the serial output
+std::vector<uint8_t> receive_param_blob(const std::vector<uint8_t> &data)
+{
+  std::vector<uint8_t> blob;
+  size_t received = 0;
+  size_t i = 0;
+  while (i + 12 <= data.size() && i + 12 + data[i + 1] <= data.size())
+  {
+    const uint8_t *payload = &data[i + 10];
+    if (data[i] == 0xFD && data[i + 7] == MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK)
+    {
+      uint8_t full[MAVLINK_MSG_ID_ROSFLIGHT_PARAM_CHUNK_LEN] = {};
+      memcpy(full, payload, data[i + 1]);
+      uint16_t blob_length = full[4] | (full[5] << 8);
+      uint16_t offset = full[6] | (full[7] << 8);
+      uint16_t chunk_crc = full[8] | (full[9] << 8);
+      uint8_t length = full[10];
+      EXPECT_EQ(crc_calculate(&full[11], length), chunk_crc);
+      EXPECT_EQ(offset, received);
+      blob.resize(blob_length);
+      memcpy(&blob[offset], &full[11], length);
+      received += length;
+    }
+    i += 12 + data[i + 1];
+  }
+  EXPECT_EQ(received, blob.size());
+  return blob;
+}
+
+TEST(mavlink_test, param_bulk_transfer)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  uint32_t hash = rf.params_.get_table_hash();
+
+  // A client without a cached table gets the names and types too
+  uint8_t request[6] = {0, 0, 0, 0, 1, 0};
+  std::vector<uint8_t> frame = mavlink2_frame(MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST, request, sizeof(request),
+                                              MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_CRC);
+  board.set_serial_rx(frame.data(), frame.size());
+  board.clear_serial_tx_data();
+  run_firmware(rf, board, 200000);
+
+  std::vector<uint8_t> blob = receive_param_blob(board.serial_tx_data());
+  ASSERT_EQ(blob.size(), 7u + 21u*PARAMS_COUNT);
+  EXPECT_EQ(blob[0] | (blob[1] << 8) | (blob[2] << 16) | (static_cast<uint32_t>(blob[3]) << 24), hash);
+  EXPECT_EQ(blob[4] | (blob[5] << 8), PARAMS_COUNT);
+  EXPECT_EQ(blob[6], 1);
+  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+  {
+    int32_t value;
+    memcpy(&value, &blob[7 + 4*id], sizeof(value));
+    EXPECT_EQ(value, rf.params_.get_param_int(id));
+    EXPECT_STREQ(reinterpret_cast<const char *>(&blob[7 + 4*PARAMS_COUNT + 16*id]), rf.params_.get_param_name(id));
+    EXPECT_EQ(blob[7 + 20*PARAMS_COUNT + id], rf.params_.get_param_type(id) == PARAM_TYPE_INT32 ?
+                                              MAV_PARAM_TYPE_INT32 : MAV_PARAM_TYPE_REAL32);
+  }
+
+  // With the table cached, only the values are sent, in tens of milliseconds
+  memcpy(request, &hash, sizeof(hash));
+  frame = mavlink2_frame(MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST, request, sizeof(request),
+                         MAVLINK_MSG_ID_ROSFLIGHT_PARAM_BULK_REQUEST_CRC);
+  board.set_serial_rx(frame.data(), frame.size());
+  board.clear_serial_tx_data();
+  run_firmware(rf, board, 40000);
+
+  blob = receive_param_blob(board.serial_tx_data());
+  ASSERT_EQ(blob.size(), 7u + 4u*PARAMS_COUNT);
+  EXPECT_EQ(blob[6], 0);
+  float value;
+  memcpy(&value, &blob[7 + 4*PARAM_ARM_THRESHOLD], sizeof(value));
+  EXPECT_EQ(value, rf.params_.get_param_float(PARAM_ARM_THRESHOLD));
+}
+
+TEST(mavlink_test, deferred_log)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  run_firmware(rf, board, 100000);
+
+  // Nothing is sent by the call itself
+  board.clear_serial_tx_data();
+  rf.mavlink_.log(Mavlink::LOG_INFO, "%s switch mapped to RC channel %d", "ARM", 4);
+  EXPECT_TRUE(board.serial_tx_data().empty());
+
+  // As a format id and raw arguments when there are no strings to send
+  rf.params_.set_param_int(PARAM_MAVLINK_VERSION, Mavlink::MAVLINK_VERSION_2);
+  rf.params_.set_param_int(PARAM_LOG_BINARY, 1);
+  rf.mavlink_.log(Mavlink::LOG_ERROR, "unable to arm due to error code 0x%x", 0x20);
+  run_firmware(rf, board, 20000);
+  const std::vector<uint8_t> &data = board.serial_tx_data();
+  bool found = false;
+  for (size_t i = 0; i + 12 <= data.size(); i += 12 + data[i + 1])
+  {
+    if (data[i] != 0xFD || data[i + 7] != MAVLINK_MSG_ID_ROSFLIGHT_LOG)
+      continue;
+    uint32_t format_id;
+    memcpy(&format_id, &data[i + 10], sizeof(format_id));
+    EXPECT_EQ(format_id, 0xA0510378u);
+    EXPECT_EQ(data[i + 14], Mavlink::LOG_ERROR);
+    EXPECT_EQ(data[i + 15], 0x20);
+    EXPECT_EQ(data[i + 1], 6); // the unused arguments are truncated
+    found = true;
+  }
+  EXPECT_TRUE(found);
+
+  // A full queue drops messages instead of blocking
+  for (int i = 0; i < 20; i++)
+    rf.mavlink_.log(Mavlink::LOG_INFO, "Booting");
+  EXPECT_EQ(rf.mavlink_.log_dropped(), 5u);
+}
+
+TEST(mavlink_test, host_clock_estimate)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  rf.params_.set_param_int(PARAM_MAVLINK_VERSION, Mavlink::MAVLINK_VERSION_2);
+  rf.params_.set_param_int(PARAM_TIMESYNC_STAMP, 1);
+
+  // The host clock runs 50 ppm fast, and answers take 2 ms each way with every fifth one held up
+  const double skew = 50e-6;
+  const int64_t offset_ns = 1500000000000000000ll;
+  auto host_ns = [&](uint64_t time_us) { return offset_ns + static_cast<int64_t>(time_us * 1000 * (1.0 + skew)); };
+  std::vector<std::pair<uint64_t, std::vector<uint8_t>>> answers;
+  uint32_t requests = 0;
+
+  board.clear_serial_tx_data();
+  while (board.clock_micros() < 20000000)
+  {
+    run_firmware(rf, board, 1000);
+    const std::vector<uint8_t> &data = board.serial_tx_data();
+    for (size_t i = 0; i + 12 <= data.size(); i += 12 + data[i + 1])
+    {
+      uint8_t payload[16] = {};
+      if (data[i] != 0xFD || data[i + 7] != MAVLINK_MSG_ID_TIMESYNC || data[i + 1] > sizeof(payload)
+          || i + 12 + data[i + 1] > data.size())
+        continue;
+      memcpy(payload, &data[i + 10], data[i + 1]);
+      int64_t tc1, ts1;
+      memcpy(&tc1, payload, sizeof(tc1));
+      memcpy(&ts1, payload + 8, sizeof(ts1));
+      if (tc1 != 0)
+        continue;
+      uint64_t delay_us = (++requests % 5 == 0) ? 30000 : 2000;
+      tc1 = host_ns(board.clock_micros() + 2000);
+      memcpy(payload, &tc1, sizeof(tc1));
+      answers.push_back(std::make_pair(board.clock_micros() + 2000 + delay_us,
+                                       mavlink2_frame(MAVLINK_MSG_ID_TIMESYNC, payload, sizeof(payload), 34)));
+    }
+    board.clear_serial_tx_data();
+    if (!answers.empty() && answers.front().first <= board.clock_micros())
+    {
+      board.set_serial_rx(answers.front().second.data(), answers.front().second.size());
+      answers.erase(answers.begin());
+    }
+  }
+  EXPECT_GT(requests, 150u);
+
+  // The held up answers are left out, so the midpoint of the round trip is the host's receive time
+  ASSERT_TRUE(rf.mavlink_.host_time_valid());
+  EXPECT_NEAR(rf.mavlink_.timesync_rtt_us(), 4000, 2000);
+  EXPECT_NEAR(rf.mavlink_.host_skew(), skew, 10e-6);
+  uint64_t now_us = board.clock_micros();
+  EXPECT_NEAR(static_cast<double>(rf.mavlink_.host_time_us(now_us)), host_ns(now_us) / 1000.0, 1000.0);
+
+  // IMU messages are stamped in host time
+  run_firmware(rf, board, 10000);
+  const std::vector<uint8_t> &data = board.serial_tx_data();
+  bool found = false;
+  for (size_t i = 0; i + 12 <= data.size(); i += 12 + data[i + 1])
+  {
+    if (data[i] != 0xFD || data[i + 7] != MAVLINK_MSG_ID_SMALL_IMU)
+      continue;
+    uint64_t time_us = 0;
+    memcpy(&time_us, &data[i + 10], data[i + 1] < sizeof(time_us) ? data[i + 1] : sizeof(time_us));
+    EXPECT_NEAR(static_cast<double>(time_us), host_ns(board.clock_micros()) / 1000.0, 20000.0);
+    found = true;
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST(mavlink_test, servo_output_raw_paging)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  rf.params_.set_param_int(PARAM_MAVLINK_VERSION, Mavlink::MAVLINK_VERSION_2);
+  rf.params_.set_param_int(PARAM_MOTOR_MIN_PWM, 1100);
+  board.clear_serial_tx_data();
+  run_firmware(rf, board, 100000);
+
+  // Each group of 8 outputs past the first goes out numbered by port, padded with zeros
+  const uint16_t *pwm = rf.mixer_.get_pwm_outputs();
+  const std::vector<uint8_t> &data = board.serial_tx_data();
+  std::vector<int> messages((Mixer::NUM_OUTPUTS + 7) / 8, 0);
+  for (size_t i = 0; i + 12 <= data.size(); i += 12 + data[i + 1])
+  {
+    uint32_t msgid = data[i + 7] | (data[i + 8] << 8) | (data[i + 9] << 16);
+    if (data[i] != 0xFD || msgid != MAVLINK_MSG_ID_SERVO_OUTPUT_RAW)
+      continue;
+    uint8_t payload[21] = {}; // MAVLink 2 drops trailing zeros
+    memcpy(payload, &data[i + 10], data[i + 1]);
+    uint8_t port = payload[20];
+    ASSERT_GE(port, 1);
+    ASSERT_LT(port, messages.size());
+    messages[port]++;
+    for (int j = 0; j < 8; j++)
+    {
+      uint16_t value = static_cast<uint16_t>(payload[4 + 2*j] | (payload[5 + 2*j] << 8));
+      EXPECT_EQ(value, (8*port + j < Mixer::NUM_OUTPUTS) ? pwm[8*port + j] : 0) << "port " << int(port);
+    }
+  }
+  for (size_t port = 1; port < messages.size(); port++)
+    EXPECT_GT(messages[port], 0) << "port " << port;
+  EXPECT_EQ(pwm[Mixer::NUM_OUTPUTS - 1], 1100);
+}
+
+TEST(mavlink_test, imu_stream_decimation)
+{
+  // IMU rates with and without a whole number of samples per requested period
+  const uint32_t imu_periods_us[] = { 1000, 1250, 1000 };
+  const int32_t stream_rates[] = { 250, 200, 300 };
+  const uint64_t expected_spacing_us[] = { 4000, 5000, 3000 };
+  for (int k = 0; k < 3; k++)
+  {
+    testBoard board;
+    ROSflight rf(board);
+    rf.init();
+    rf.params_.set_param_int(PARAM_MAVLINK_VERSION, Mavlink::MAVLINK_VERSION_2);
+    rf.params_.set_param_int(PARAM_STREAM_IMU_RATE, stream_rates[k]);
+
+    // The decimation is chosen from the IMU rate measured over the first second
+    float acc[3] = {0, 0, -9.80665f};
+    float gyro[3] = {0, 0, 0};
+    auto run_imu = [&](uint64_t duration_us)
+    {
+      uint64_t start_us = board.clock_micros();
+      while (board.clock_micros() < start_us + duration_us)
+      {
+        board.set_imu(acc, gyro, board.clock_micros() + imu_periods_us[k]);
+        rf.run();
+        rf.run();
+      }
+    };
+    run_imu(1500000);
+    board.clear_serial_tx_data();
+    run_imu(1000000);
+
+    // Every transmitted sample is a different one, and they are evenly spaced
+    std::vector<uint64_t> stamps;
+    const std::vector<uint8_t> &data = board.serial_tx_data();
+    for (size_t i = 0; i + 12 <= data.size(); i += 12 + data[i + 1])
+    {
+      uint32_t msgid = data[i + 7] | (data[i + 8] << 8) | (data[i + 9] << 16);
+      if (data[i] != 0xFD || msgid != MAVLINK_MSG_ID_SMALL_IMU)
+        continue;
+      uint8_t payload[MAVLINK_MSG_ID_SMALL_IMU_LEN] = {};
+      memcpy(payload, &data[i + 10], data[i + 1]);
+      uint64_t time_us;
+      memcpy(&time_us, payload, sizeof(time_us));
+      stamps.push_back(time_us);
+    }
+    ASSERT_GT(stamps.size(), 1000000 / expected_spacing_us[k] - 2) << "rate " << stream_rates[k];
+    for (size_t i = 1; i < stamps.size(); i++)
+      EXPECT_EQ(stamps[i] - stamps[i - 1], expected_spacing_us[k]) << "rate " << stream_rates[k];
+  }
+}
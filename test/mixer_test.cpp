@@ -0,0 +1,283 @@
+#include "common.h"
+#include "rosflight.h"
+#include "test_board.h"
+
+using namespace rosflight_firmware;
+
+namespace
+{
+
+// Quadcopter X mixer columns
+const float QUAD_X_X[4] = {-1.0f, -1.0f, 1.0f, 1.0f};
+const float QUAD_X_Y[4] = { 1.0f, -1.0f,-1.0f, 1.0f};
+const float QUAD_X_Z[4] = { 1.0f, -1.0f, 1.0f,-1.0f};
+
+// Fly a quadcopter X from RC in rate mode with unit P gains on the rate loops and no gyro
+// input, so the controller output is simply the stick positions
+void setup_firmware(ROSflight& rf, testBoard& board)
+{
+  board.set_pwm_lost(false);
+  rf.init();
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::QUADCOPTER_X);
+  rf.params_.set_param_int(PARAM_RC_ATTITUDE_MODE, 0);
+  rf.params_.set_param_int(PARAM_RC_ARM_CHANNEL, 4);
+  rf.params_.set_param_float(PARAM_RC_MAX_ROLLRATE, 1.0f);
+  rf.params_.set_param_float(PARAM_RC_MAX_PITCHRATE, 1.0f);
+  rf.params_.set_param_float(PARAM_RC_MAX_YAWRATE, 1.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_P, 1.0f);
+  rf.params_.set_param_float(PARAM_PID_PITCH_RATE_P, 1.0f);
+  rf.params_.set_param_float(PARAM_PID_YAW_RATE_P, 1.0f);
+  rf.params_.set_param_float(PARAM_PID_ROLL_RATE_D, 0.0f);
+  rf.params_.set_param_float(PARAM_PID_PITCH_RATE_D, 0.0f);
+  rf.params_.set_param_float(PARAM_PID_YAW_RATE_D, 0.0f);
+  rf.state_manager_.clear_error(rf.state_manager_.state().error_codes);
+}
+
+void fly(ROSflight& rf, testBoard& board, bool armed, float F, float x, float y, float z)
+{
+  uint16_t rc_values[8] = { static_cast<uint16_t>(1500 + 500*x), static_cast<uint16_t>(1500 + 500*y),
+                            static_cast<uint16_t>(1000 + 1000*F), static_cast<uint16_t>(1500 + 500*z),
+                            static_cast<uint16_t>(armed ? 2000 : 1000), 1500, 1500, 1500 };
+  board.set_rc(rc_values);
+
+  float acc[3] = {0.0f, 0.0f, -9.80665f};
+  float gyro[3] = {0.0f, 0.0f, 0.0f};
+  uint64_t start_us = board.clock_micros();
+  while (board.clock_micros() < start_us + 100000)
+  {
+    board.set_imu(acc, gyro, board.clock_micros() + 1000);
+    rf.run();
+    rf.run(); // the other sensors are only read between IMU samples
+  }
+}
+
+float torque(const ROSflight& rf, const float column[4])
+{
+  float sum = 0.0f;
+  for (int i = 0; i < 4; i++)
+    sum += column[i]*rf.mixer_.get_outputs()[i];
+  return sum;
+}
+
+} // namespace
+
+TEST(mixer_test, yaw_gives_way_to_roll_at_full_throttle)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+  ASSERT_TRUE(rf.state_manager_.state().armed);
+
+  // The motors on one side are at full throttle after roll and pitch, so there is no room for
+  // yaw without losing roll
+  fly(rf, board, true, 0.9f, 0.4f, 0.0f, 0.4f);
+  EXPECT_NEAR(rf.controller_.output().x, 0.4f, 1e-3);
+  EXPECT_NEAR(rf.controller_.output().z, 0.4f, 1e-3);
+  for (int i = 0; i < 4; i++)
+    EXPECT_LE(rf.mixer_.get_outputs()[i], 1.0f);
+  EXPECT_NEAR(torque(rf, QUAD_X_X), 1.6f, 1e-3);
+  EXPECT_NEAR(torque(rf, QUAD_X_Y), 0.0f, 1e-3);
+
+  fly(rf, board, true, 1.0f, 0.2f, 0.0f, 1.0f);
+  for (int i = 0; i < 4; i++)
+    EXPECT_LE(rf.mixer_.get_outputs()[i], 1.0f);
+  EXPECT_NEAR(torque(rf, QUAD_X_X), 0.8f, 1e-3);
+  EXPECT_NEAR(torque(rf, QUAD_X_Y), 0.0f, 1e-3);
+
+  // With no roll or pitch, full yaw is had by lowering throttle
+  fly(rf, board, true, 1.0f, 0.0f, 0.0f, 0.4f);
+  EXPECT_NEAR(torque(rf, QUAD_X_Z), 1.6f, 1e-3);
+}
+
+TEST(mixer_test, low_throttle_airmode)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  float idle = rf.params_.get_param_float(PARAM_MOTOR_IDLE_THROTTLE);
+
+  // Without air mode the throttle stays put and the motors are held at idle, losing some roll
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.5f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.05f, 0.4f, 0.0f, 0.0f);
+  EXPECT_NEAR(rf.mixer_.get_outputs()[0], idle, 1e-3);
+  EXPECT_NEAR(rf.mixer_.get_outputs()[2], 0.45f, 1e-3);
+  EXPECT_NEAR(torque(rf, QUAD_X_X), 0.9f - 2.0f*idle, 1e-3);
+
+  // Air mode raises the throttle to keep the full roll command
+  rf.params_.set_param_int(PARAM_MIXER_AIRMODE, 1);
+  fly(rf, board, true, 0.05f, 0.4f, 0.0f, 0.0f);
+  EXPECT_NEAR(rf.mixer_.get_outputs()[0], idle, 1e-3);
+  EXPECT_NEAR(torque(rf, QUAD_X_X), 1.6f, 1e-3);
+  EXPECT_NEAR(torque(rf, QUAD_X_Y), 0.0f, 1e-3);
+
+  // but not until the throttle has been raised after arming
+  fly(rf, board, false, 0.0f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.05f, 0.4f, 0.0f, 0.0f);
+  EXPECT_NEAR(torque(rf, QUAD_X_X), 0.9f - 2.0f*idle, 1e-3);
+}
+
+TEST(mixer_test, thrust_curve_and_battery_scaling)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+
+  // Each motor gets the throttle that produces the thrust asked for
+  const float expo = 0.5f;
+  rf.params_.set_param_float(PARAM_THRUST_EXPO, expo);
+  fly(rf, board, true, 0.5f, 0.0f, 0.0f, 0.0f);
+  float u = rf.mixer_.get_outputs()[0];
+  EXPECT_NEAR((1.0f - expo)*u + expo*u*u, 0.5f, 2e-3);
+  EXPECT_NEAR(rf.mixer_.get_mixed_outputs()[0], 0.5f, 1e-4);
+
+  // A sagging battery scales the throttle up
+  rf.params_.set_param_float(PARAM_THRUST_EXPO, 0.0f);
+  rf.params_.set_param_float(PARAM_BATTERY_VOLTAGE_ALPHA, 0.0f);
+  rf.params_.set_param_float(PARAM_BATTERY_VOLTAGE_REFERENCE, 16.0f);
+  board.set_battery_voltage(12.0f);
+  fly(rf, board, true, 0.5f, 0.0f, 0.0f, 0.0f);
+  EXPECT_NEAR(rf.mixer_.get_outputs()[0], 0.5f*16.0f/12.0f, 1e-4);
+  EXPECT_NEAR(rf.mixer_.get_mixed_outputs()[0], 0.5f, 1e-4);
+
+  // and leaves less thrust to desaturate into, so the scaled outputs keep their roll and pitch
+  // priority rather than being clamped
+  fly(rf, board, true, 0.9f, 0.4f, 0.0f, 0.0f);
+  float upper = 12.0f/16.0f;
+  float idle = rf.params_.get_param_float(PARAM_MOTOR_IDLE_THROTTLE);
+  for (int i = 0; i < 4; i++)
+    EXPECT_LE(rf.mixer_.get_outputs()[i], 1.0f + 1e-6);
+  EXPECT_NEAR(rf.mixer_.get_outputs()[0], idle, 1e-4);
+  EXPECT_NEAR(rf.mixer_.get_outputs()[2], 1.0f, 1e-4);
+  EXPECT_NEAR(torque(rf, QUAD_X_X), 2.0f*(1.0f - idle), 1e-3);
+  EXPECT_NEAR(torque(rf, QUAD_X_Y), 0.0f, 1e-4);
+  EXPECT_NEAR(rf.mixer_.get_mixed_outputs()[2], upper, 1e-4);
+}
+
+TEST(mixer_test, esc_calibration_passes_throttle)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::ESC_CALIBRATION);
+  rf.params_.set_param_float(PARAM_THRUST_EXPO, 0.5f);
+  rf.params_.set_param_float(PARAM_BATTERY_VOLTAGE_ALPHA, 0.0f);
+  rf.params_.set_param_float(PARAM_BATTERY_VOLTAGE_REFERENCE, 16.0f);
+  board.set_battery_voltage(12.0f);
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+
+  fly(rf, board, true, 0.6f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < 6; i++)
+    EXPECT_NEAR(rf.mixer_.get_outputs()[i], 0.6f, 1e-4);
+  fly(rf, board, true, 1.0f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < 6; i++)
+    EXPECT_NEAR(rf.mixer_.get_outputs()[i], 1.0f, 1e-4);
+}
+
+TEST(mixer_test, custom_mixer_unpacks_q2_13)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+
+  // Motor, servo, GPIO on outputs 0-2, and nothing on the rest
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_TYPES, 0x36);
+  // F = 1.0, x = -1.0; y = 0.5, z = -0.25
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_0_FX, static_cast<int32_t>(0x2000E000u));
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_0_YZ, static_cast<int32_t>(0x1000F800u));
+  // Full scale: F = 4 - 2^-13, x = -4; y = -2^-13, z = 2^-13
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_1_FX, static_cast<int32_t>(0x7FFF8000u));
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_1_YZ, static_cast<int32_t>(0xFFFF0001u));
+  // Coefficients on an unused output are ignored
+  rf.params_.set_param_int(PARAM_CUSTOM_MIXER_3_FX, 0x20002000);
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::CUSTOM);
+
+  const Mixer::mixer_t* mixer = rf.mixer_.get_mixer();
+  EXPECT_EQ(mixer->output_type[0], Mixer::M);
+  EXPECT_EQ(mixer->output_type[1], Mixer::S);
+  EXPECT_EQ(mixer->output_type[2], Mixer::G);
+  EXPECT_FLOAT_EQ(mixer->F[0], 1.0f);
+  EXPECT_FLOAT_EQ(mixer->x[0], -1.0f);
+  EXPECT_FLOAT_EQ(mixer->y[0], 0.5f);
+  EXPECT_FLOAT_EQ(mixer->z[0], -0.25f);
+  EXPECT_FLOAT_EQ(mixer->F[1], 4.0f - 1.0f/8192.0f);
+  EXPECT_FLOAT_EQ(mixer->x[1], -4.0f);
+  EXPECT_FLOAT_EQ(mixer->y[1], -1.0f/8192.0f);
+  EXPECT_FLOAT_EQ(mixer->z[1], 1.0f/8192.0f);
+  EXPECT_FLOAT_EQ(mixer->F[2], 0.0f);
+
+  // Outputs without a type, including any past the 8 that have params, drive nothing
+  for (int i = 3; i < Mixer::NUM_OUTPUTS; i++)
+  {
+    EXPECT_EQ(mixer->output_type[i], Mixer::NONE) << "output " << i;
+    if (i >= 8)
+    {
+      EXPECT_FLOAT_EQ(mixer->F[i], 0.0f) << "output " << i;
+    }
+  }
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.5f, 0.0f, 0.0f, 0.0f);
+  for (int i = 3; i < Mixer::NUM_OUTPUTS; i++)
+    EXPECT_EQ(rf.mixer_.get_outputs()[i], 0.0f) << "output " << i;
+  EXPECT_GT(rf.mixer_.get_outputs()[0], 0.0f);
+}
+
+namespace
+{
+
+// Each output's PWM as write_motor() and write_servo() used to compute it one channel at a time,
+// with unused outputs left where pwm_init() put them
+void expect_per_channel_pwm(const ROSflight& rf, const testBoard& board)
+{
+  const Mixer::mixer_t* mixer = rf.mixer_.get_mixer();
+  int32_t min_pwm = rf.params_.get_param_int(PARAM_MOTOR_MIN_PWM);
+  int32_t max_pwm = rf.params_.get_param_int(PARAM_MOTOR_MAX_PWM);
+  ASSERT_EQ(board.pwm_outputs().size(), Mixer::NUM_OUTPUTS);
+  for (int i = 0; i < Mixer::NUM_OUTPUTS; i++)
+  {
+    float value = rf.mixer_.get_outputs()[i];
+    uint16_t expected;
+    if (mixer->output_type[i] == Mixer::M)
+      expected = static_cast<uint16_t>(static_cast<int32_t>(value * (max_pwm - min_pwm) + min_pwm));
+    else if (mixer->output_type[i] == Mixer::S)
+      expected = static_cast<uint16_t>(value * 500 + 1500);
+    else
+      expected = static_cast<uint16_t>(min_pwm);
+    EXPECT_EQ(board.pwm_outputs()[i], expected) << "output " << i;
+  }
+}
+
+} // namespace
+
+TEST(mixer_test, pwm_matches_per_channel_writes)
+{
+  testBoard board;
+  ROSflight rf(board);
+  setup_firmware(rf, board);
+  rf.params_.set_param_int(PARAM_MOTOR_MIN_PWM, 1100);
+  rf.params_.set_param_int(PARAM_MOTOR_MAX_PWM, 1900);
+
+  // Motors, disarmed, idling, in between and saturated
+  fly(rf, board, false, 0.0f, 0.0f, 0.0f, 0.0f);
+  expect_per_channel_pwm(rf, board);
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+  expect_per_channel_pwm(rf, board);
+  fly(rf, board, true, 0.37f, 0.13f, -0.21f, 0.05f);
+  expect_per_channel_pwm(rf, board);
+  fly(rf, board, true, 1.0f, 0.8f, 0.0f, -0.6f);
+  expect_per_channel_pwm(rf, board);
+
+  // Servos and motors together, with the servos past their limits
+  rf.params_.set_param_int(PARAM_FIXED_WING, 1);
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::FIXEDWING);
+  fly(rf, board, false, 0.0f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.0f, 0.0f, 0.0f, 0.0f);
+  fly(rf, board, true, 0.53f, -0.31f, 0.77f, 0.29f);
+  expect_per_channel_pwm(rf, board);
+  EXPECT_NEAR(board.pwm_outputs()[0], 1500 - 0.31f*500, 1.0f);
+  fly(rf, board, true, 0.9f, 1.0f, -1.0f, 1.0f);
+  expect_per_channel_pwm(rf, board);
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <gtest/gtest.h>
 #include "test_board.h"
 #include "rosflight.h"
@@ -71,3 +73,156 @@ TEST(parameters_test, default_parameters_test)
   EXPECT_PARAM_EQ_INT(PARAM_RUDDER_REVERSE, 0);
   EXPECT_PARAM_EQ_FLOAT(PARAM_ARM_THRESHOLD, 0.15f);
 }
+
+TEST(parameters_test, lookup_by_name)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+    EXPECT_EQ(rf.params_.lookup_param_id(rf.params_.get_param_name(id)), id);
+
+  // Names that sort before, between and after the real ones, and a prefix of a real one
+  EXPECT_EQ(rf.params_.lookup_param_id("AAAA"), PARAMS_COUNT);
+  EXPECT_EQ(rf.params_.lookup_param_id("MIXERS"), PARAMS_COUNT);
+  EXPECT_EQ(rf.params_.lookup_param_id("ZZZZ"), PARAMS_COUNT);
+  EXPECT_EQ(rf.params_.lookup_param_id("MIXE"), PARAMS_COUNT);
+
+  // MAVLink names fill all 16 characters without a terminator when they are that long
+  char name[Params::PARAMS_NAME_LENGTH];
+  memcpy(name, "MIXER\0garbage!!!", sizeof(name));
+  EXPECT_EQ(rf.params_.lookup_param_id(name), PARAM_MIXER);
+  EXPECT_TRUE(rf.params_.set_param_by_name_int("MIXER", Mixer::QUADCOPTER_X));
+  EXPECT_PARAM_EQ_INT(PARAM_MIXER, Mixer::QUADCOPTER_X);
+}
+
+// Only prints timings, so it is left out of the default run; run it with --gtest_also_run_disabled_tests
+TEST(parameters_test, DISABLED_lookup_benchmark)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+
+  // Look up every name the way a full parameter file push does, and compare against a linear scan
+  const int rounds = 200;
+  uint32_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+      found += rf.params_.lookup_param_id(rf.params_.get_param_name(id)) == id;
+  auto indexed = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    for (uint16_t id = 0; id < PARAMS_COUNT; id++)
+      for (uint16_t other = 0; other < PARAMS_COUNT; other++)
+        if (strncmp(rf.params_.get_param_name(other), rf.params_.get_param_name(id), Params::PARAMS_NAME_LENGTH) == 0)
+        {
+          found += other == id;
+          break;
+        }
+  auto linear = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(found, 2u * rounds * PARAMS_COUNT);
+  double lookups = rounds * PARAMS_COUNT;
+  printf("lookup_param_id: %.1f ns per name, linear scan: %.1f ns per name (%d params)\n",
+         std::chrono::duration<double, std::nano>(indexed).count() / lookups,
+         std::chrono::duration<double, std::nano>(linear).count() / lookups, PARAMS_COUNT);
+}
+
+TEST(parameters_test, journaled_storage)
+{
+  testBoard board;
+  {
+    ROSflight rf(board);
+    rf.init();
+    EXPECT_EQ(board.memory_erase_count(), 2u); // the first snapshot
+
+    // Saving a change appends to the journal without erasing anything
+    rf.params_.set_param_int(PARAM_MIXER, Mixer::QUADCOPTER_X);
+    rf.params_.set_param_float(PARAM_ARM_THRESHOLD, 0.25f);
+    EXPECT_TRUE(rf.params_.write());
+    EXPECT_EQ(board.memory_erase_count(), 2u);
+  }
+
+  ROSflight rf(board);
+  rf.init();
+  EXPECT_PARAM_EQ_INT(PARAM_MIXER, Mixer::QUADCOPTER_X);
+  EXPECT_PARAM_EQ_FLOAT(PARAM_ARM_THRESHOLD, 0.25f);
+  EXPECT_EQ(board.memory_erase_count(), 2u);
+
+  // A full journal is compacted into a new snapshot in the other bank
+  for (int i = 1; i <= 300; i++)
+  {
+    rf.params_.set_param_int(PARAM_SYSTEM_ID, i % 200 + 1);
+    EXPECT_TRUE(rf.params_.write());
+  }
+  EXPECT_GE(board.memory_erase_count(), 4u);
+  EXPECT_LE(board.memory_erase_count(), 8u);
+
+  ROSflight reloaded(board);
+  reloaded.init();
+  EXPECT_EQ(reloaded.params_.get_param_int(PARAM_SYSTEM_ID), 300 % 200 + 1);
+  EXPECT_EQ(reloaded.params_.get_param_int(PARAM_MIXER), Mixer::QUADCOPTER_X);
+}
+
+TEST(parameters_test, corrupted_storage)
+{
+  testBoard board;
+  ROSflight rf(board);
+  rf.init();
+  rf.params_.set_param_int(PARAM_MIXER, Mixer::QUADCOPTER_X);
+  EXPECT_TRUE(rf.params_.write());
+  rf.params_.set_param_float(PARAM_ARM_THRESHOLD, 0.25f);
+  EXPECT_TRUE(rf.params_.write());
+
+  // The bank in use is the first one, find the end of its journal
+  size_t end = board.memory().size() / 2;
+  while (end >= 12 && std::all_of(&board.memory()[end - 12], &board.memory()[end], [](uint8_t b) { return b == 0xFF; }))
+    end -= 12;
+  std::vector<uint8_t> saved = board.memory();
+
+  // A damaged record only loses that change
+  board.memory()[end - 5] ^= 0x01;
+  {
+    ROSflight reloaded(board);
+    reloaded.init();
+    EXPECT_EQ(reloaded.params_.get_param_int(PARAM_MIXER), Mixer::QUADCOPTER_X);
+    EXPECT_EQ(reloaded.params_.get_param_float(PARAM_ARM_THRESHOLD), 0.15f);
+
+    // and the next save goes after it
+    reloaded.params_.set_param_int(PARAM_SYSTEM_ID, 7);
+    EXPECT_TRUE(reloaded.params_.write());
+  }
+  {
+    ROSflight reloaded(board);
+    reloaded.init();
+    EXPECT_EQ(reloaded.params_.get_param_int(PARAM_MIXER), Mixer::QUADCOPTER_X);
+    EXPECT_EQ(reloaded.params_.get_param_int(PARAM_SYSTEM_ID), 7);
+  }
+
+  // A damaged snapshot falls back to the other bank, and with neither valid the defaults are used
+  board.memory() = saved;
+  {
+    ROSflight reloaded(board);
+    reloaded.init();
+    for (int i = 1; i <= 200; i++)
+    {
+      reloaded.params_.set_param_int(PARAM_SYSTEM_ID, i % 200 + 1);
+      EXPECT_TRUE(reloaded.params_.write());
+    }
+  }
+  board.memory()[board.memory().size() / 2 + 100] ^= 0x01;
+  {
+    ROSflight reloaded(board);
+    reloaded.init();
+    EXPECT_EQ(reloaded.params_.get_param_int(PARAM_MIXER), Mixer::QUADCOPTER_X);
+  }
+  board.memory()[100] ^= 0x01;
+  {
+    ROSflight reloaded(board);
+    reloaded.init();
+    EXPECT_EQ(reloaded.params_.get_param_int(PARAM_MIXER), Mixer::INVALID_MIXER);
+  }
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "ring_buffer.h"
+
+using namespace rosflight_firmware;
+
+TEST(ring_buffer_test, push_pop)
+{
+  RingBuffer<8> buffer;
+  uint8_t data[6] = {1, 2, 3, 4, 5, 6};
+  uint16_t len;
+
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_TRUE(buffer.push(data, 6));
+  EXPECT_EQ(buffer.size(), 6);
+  EXPECT_EQ(buffer.space(), 2);
+
+  // Doesn't fit, so nothing is queued
+  EXPECT_FALSE(buffer.push(data, 3));
+  EXPECT_EQ(buffer.size(), 6);
+
+  const uint8_t *out = buffer.peek(&len);
+  EXPECT_EQ(len, 6);
+  EXPECT_EQ(out[0], 1);
+  buffer.pop(4);
+  EXPECT_EQ(buffer.size(), 2);
+}
+
+TEST(ring_buffer_test, wrap)
+{
+  RingBuffer<8> buffer;
+  uint8_t data[6] = {1, 2, 3, 4, 5, 6};
+  uint16_t len;
+
+  // Run the indices through a wrap of the storage and of the uint16 counters
+  for (int i = 0; i < 20000; i++)
+  {
+    ASSERT_TRUE(buffer.push(data, 6));
+
+    uint8_t received[6];
+    uint16_t count = 0;
+    while (!buffer.empty())
+    {
+      const uint8_t *out = buffer.peek(&len);
+      ASSERT_GT(len, 0);
+      for (uint16_t j = 0; j < len; j++)
+        received[count + j] = out[j];
+      count += len;
+      buffer.pop(len);
+    }
+    ASSERT_EQ(count, 6);
+    for (int j = 0; j < 6; j++)
+      ASSERT_EQ(received[j], data[j]);
+  }
+}
+
+TEST(ring_buffer_test, reserve_commit)
+{
+  RingBuffer<8> buffer;
+  uint8_t header[2] = {1, 2};
+  uint8_t payload[3] = {3, 4, 5};
+  uint16_t len;
+
+  // Written bytes stay hidden from the consumer until they are committed
+  ASSERT_TRUE(buffer.reserve(5));
+  buffer.write(header, 2);
+  buffer.write(payload, 3);
+  EXPECT_TRUE(buffer.empty());
+  buffer.commit();
+  EXPECT_EQ(buffer.size(), 5);
+
+  EXPECT_FALSE(buffer.reserve(4));
+  buffer.pop(5);
+
+  // A reservation that wraps the storage
+  ASSERT_TRUE(buffer.reserve(5));
+  buffer.write(header, 2);
+  buffer.write(payload, 3);
+  buffer.commit();
+  const uint8_t *out = buffer.peek(&len);
+  EXPECT_EQ(len, 3);
+  EXPECT_EQ(out[0], 1);
+  buffer.pop(len);
+  out = buffer.peek(&len);
+  EXPECT_EQ(len, 2);
+  EXPECT_EQ(out[0], 4);
+}
@@ -29,6 +29,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #include "test_board.h"
 
 #pragma GCC diagnostic push
@@ -50,11 +52,45 @@ namespace rosflight_firmware
     time_us_ = time_us;
   }
 
+  void testBoard::set_serial_tx_space(size_t space)
+  {
+    serial_tx_space_ = space;
+  }
+
+  void testBoard::set_serial_rx(const uint8_t *src, size_t len)
+  {
+    serial_rx_data_.assign(src, src + len);
+    serial_rx_index_ = 0;
+  }
+
+  void testBoard::set_battery_voltage(float voltage)
+  {
+    battery_voltage_ = voltage;
+  }
+
+  void testBoard::set_diff_pressure(float pressure, float temperature)
+  {
+    diff_pressure_present_ = true;
+    diff_pressure_ = pressure;
+    diff_pressure_temp_ = temperature;
+  }
+
   void testBoard::set_pwm_lost(bool lost)
   {
     rc_lost_ = lost;
   }
 
+  void testBoard::set_dshot_telemetry(uint8_t channel, uint32_t raw)
+  {
+    dshot_telemetry_[channel] = raw;
+    dshot_telemetry_valid_[channel] = true;
+  }
+
+  const uint16_t *testBoard::dshot_buffer(uint8_t channel) const
+  {
+    return &dshot_buffers_[channel * DShot::BUFFER_LENGTH];
+  }
+
   void testBoard::set_imu(float *acc, float *gyro, uint64_t time_us)
   {
     time_us_ = time_us;
@@ -79,8 +115,30 @@ namespace rosflight_firmware
 // serial
   void testBoard::serial_init(uint32_t baud_rate){}
   void testBoard::serial_write(const uint8_t *src, size_t len){}
-  uint16_t testBoard::serial_bytes_available(void){ return 0; }
-  uint8_t testBoard::serial_read(void){return 0;}
+  size_t testBoard::serial_write_nonblocking(const uint8_t *src, size_t len)
+  {
+    if (len > serial_tx_space_)
+      len = serial_tx_space_;
+    serial_tx_space_ -= len;
+    serial_tx_bytes_ += len;
+    serial_tx_data_.insert(serial_tx_data_.end(), src, src + len);
+    return len;
+  }
+  uint16_t testBoard::serial_bytes_available(void)
+  {
+    return static_cast<uint16_t>(serial_rx_data_.size() - serial_rx_index_);
+  }
+  uint8_t testBoard::serial_read(void)
+  {
+    return (serial_rx_index_ < serial_rx_data_.size()) ? serial_rx_data_[serial_rx_index_++] : 0;
+  }
+  size_t testBoard::serial_read(uint8_t *dst, size_t len)
+  {
+    size_t count = 0;
+    while (count < len && serial_rx_index_ < serial_rx_data_.size())
+      dst[count++] = serial_rx_data_[serial_rx_index_++];
+    return count;
+  }
 
 // sensors
   void testBoard::sensors_init(){}
@@ -117,23 +175,95 @@ namespace rosflight_firmware
   bool testBoard::baro_check(void){ return false; }
   void testBoard::baro_read(float *pressure, float *temperature) {}
 
-  bool testBoard::diff_pressure_check(void){ return false; }
-  void testBoard::diff_pressure_read(float *diff_pressure, float *temperature) {}
+  bool testBoard::diff_pressure_check(void){ return diff_pressure_present_; }
+  void testBoard::diff_pressure_read(float *diff_pressure, float *temperature)
+  {
+    *diff_pressure = diff_pressure_;
+    *temperature = diff_pressure_temp_;
+  }
 
   bool testBoard::sonar_check(void){ return false; }
   float testBoard::sonar_read(void){return 0;}
+  float testBoard::battery_read(void){return battery_voltage_;}
 
 // PWM
 // TODO make these deal in normalized (-1 to 1 or 0 to 1) values (not pwm-specific)
   void testBoard::pwm_init(bool cppm, uint32_t refresh_rate, uint16_t idle_pwm){}
   bool testBoard::pwm_lost(){ return rc_lost_; }
   uint16_t testBoard::pwm_read(uint8_t channel){ return rc_values[channel];}
-  void testBoard::pwm_write(uint8_t channel, uint16_t value){}
+  void testBoard::pwm_write(uint8_t channel, uint16_t value)
+  {
+    if (channel >= pwm_outputs_.size())
+      pwm_outputs_.resize(channel + 1, 0);
+    pwm_outputs_[channel] = value;
+  }
+  void testBoard::pwm_write_all(const uint16_t *values, uint8_t num_channels)
+  {
+    pwm_outputs_.assign(values, values + num_channels);
+  }
+
+// DShot (emulates a 72 MHz timer)
+  uint16_t testBoard::dshot_init(uint32_t bitrate, bool bidirectional)
+  {
+    dshot_bit_ticks_ = static_cast<uint16_t>(72000000 / bitrate);
+    return dshot_bit_ticks_;
+  }
+  void testBoard::dshot_write(const uint16_t *buffers, uint8_t num_channels)
+  {
+    for (int i = 0; i < num_channels * DShot::BUFFER_LENGTH && i < 8 * DShot::BUFFER_LENGTH; i++)
+      dshot_buffers_[i] = buffers[i];
+  }
+  bool testBoard::dshot_telemetry_read(uint8_t channel, uint32_t *raw)
+  {
+    if (channel >= 8 || !dshot_telemetry_valid_[channel])
+      return false;
+    *raw = dshot_telemetry_[channel];
+    return true;
+  }
 
 // non-volatile memory
   void testBoard::memory_init(void){}
-  bool testBoard::memory_read(void *dest, size_t len){ return false; }
-  bool testBoard::memory_write(const void *src, size_t len){ return false; }
+  size_t testBoard::memory_sector_size(void){ return MEMORY_SECTOR_SIZE; }
+  uint8_t testBoard::memory_sector_count(void){ return MEMORY_SECTOR_COUNT; }
+  bool testBoard::memory_read(size_t offset, void *dest, size_t len)
+  {
+    if (offset + len > memory_.size())
+      return false;
+    memcpy(dest, &memory_[offset], len);
+    return true;
+  }
+  bool testBoard::memory_program(size_t offset, const void *src, size_t len)
+  {
+    if (offset + len > memory_.size() || offset % 4 || len % 4)
+      return false;
+    // Like flash, programming can only clear bits
+    const uint8_t *bytes = static_cast<const uint8_t *>(src);
+    for (size_t i = 0; i < len; i++)
+      memory_[offset + i] &= bytes[i];
+    return memcmp(&memory_[offset], src, len) == 0;
+  }
+  bool testBoard::memory_erase(uint8_t sector)
+  {
+    if (sector >= MEMORY_SECTOR_COUNT)
+      return false;
+    memset(&memory_[sector * MEMORY_SECTOR_SIZE], 0xFF, MEMORY_SECTOR_SIZE);
+    memory_erase_count_++;
+    return true;
+  }
+
+// blackbox log
+  bool testBoard::log_init(void)
+  {
+    log_data_.clear();
+    return true;
+  }
+  bool testBoard::log_write(const uint8_t *page, size_t len)
+  {
+    if (log_data_.size() + len > log_capacity_)
+      return false;
+    log_data_.insert(log_data_.end(), page, page + len);
+    return true;
+  }
 
 // LEDs
   void testBoard::led0_on(void){}
@@ -32,7 +32,10 @@
 #ifndef ROSFLIGHT_FIRMWARE_TEST_BOARD_H
 #define ROSFLIGHT_FIRMWARE_TEST_BOARD_H
 
+#include <vector>
+
 #include "board.h" 
+#include "dshot.h"
 
 namespace rosflight_firmware
 {
@@ -47,6 +50,24 @@ private:
   float acc_[3] = {0, 0, 0};
   float gyro_[3] = {0, 0, 0};
   bool new_imu_ = false;
+  float battery_voltage_ = 0;
+  bool diff_pressure_present_ = false;
+  float diff_pressure_ = 0;
+  float diff_pressure_temp_ = 0;
+  uint16_t dshot_bit_ticks_ = 0;
+  uint16_t dshot_buffers_[8 * DShot::BUFFER_LENGTH] = {};
+  uint32_t dshot_telemetry_[8] = {};
+  bool dshot_telemetry_valid_[8] = {};
+  size_t serial_tx_space_ = SIZE_MAX;
+  size_t serial_tx_bytes_ = 0;
+  std::vector<uint8_t> serial_tx_data_;
+  std::vector<uint8_t> serial_rx_data_;
+  size_t serial_rx_index_ = 0;
+  std::vector<uint8_t> log_data_;
+  std::vector<uint16_t> pwm_outputs_;
+  std::vector<uint8_t> memory_ = std::vector<uint8_t>(MEMORY_SECTOR_COUNT * MEMORY_SECTOR_SIZE, 0xFF);
+  uint32_t memory_erase_count_ = 0;
+  size_t log_capacity_ = SIZE_MAX;
 
 public:
 // setup
@@ -61,8 +82,10 @@ public:
 // serial
   void serial_init(uint32_t baud_rate);
   void serial_write(const uint8_t *src, size_t len);
+  size_t serial_write_nonblocking(const uint8_t *src, size_t len);
   uint16_t serial_bytes_available(void);
   uint8_t serial_read(void);
+  size_t serial_read(uint8_t *dst, size_t len);
 
 // sensors
   void sensors_init();
@@ -84,17 +107,33 @@ public:
   bool sonar_check(void);
   float sonar_read(void);
 
+  float battery_read(void);
+
 // PWM
 // TODO make these deal in normalized (-1 to 1 or 0 to 1) values (not pwm-specific)
   void pwm_init(bool cppm, uint32_t refresh_rate, uint16_t idle_pwm);
   bool pwm_lost();
   uint16_t pwm_read(uint8_t channel);
   void pwm_write(uint8_t channel, uint16_t value);
+  void pwm_write_all(const uint16_t *values, uint8_t num_channels);
+
+  uint16_t dshot_init(uint32_t bitrate, bool bidirectional);
+  void dshot_write(const uint16_t *buffers, uint8_t num_channels);
+  bool dshot_telemetry_read(uint8_t channel, uint32_t *raw);
 
 // non-volatile memory
+  static constexpr size_t MEMORY_SECTOR_SIZE = 1024;
+  static constexpr uint8_t MEMORY_SECTOR_COUNT = 4;
   void memory_init(void);
-  bool memory_read(void *dest, size_t len);
-  bool memory_write(const void *src, size_t len);
+  size_t memory_sector_size(void);
+  uint8_t memory_sector_count(void);
+  bool memory_read(size_t offset, void *dest, size_t len);
+  bool memory_program(size_t offset, const void *src, size_t len);
+  bool memory_erase(uint8_t sector);
+
+// blackbox log
+  bool log_init(void);
+  bool log_write(const uint8_t *page, size_t len);
 
 // LEDs
   void led0_on(void);
@@ -111,6 +150,21 @@ public:
   void set_rc(uint16_t* values);
   void set_time(uint64_t time_us);
   void set_pwm_lost(bool lost);
+  void set_battery_voltage(float voltage);
+  void set_diff_pressure(float pressure, float temperature);
+  void set_serial_tx_space(size_t space);
+  inline size_t serial_tx_bytes() const { return serial_tx_bytes_; }
+  inline const std::vector<uint8_t> &serial_tx_data() const { return serial_tx_data_; }
+  inline void clear_serial_tx_data() { serial_tx_data_.clear(); }
+  void set_serial_rx(const uint8_t *src, size_t len);
+  void set_dshot_telemetry(uint8_t channel, uint32_t raw);
+  const uint16_t *dshot_buffer(uint8_t channel) const;
+  inline uint16_t dshot_bit_ticks() const { return dshot_bit_ticks_; }
+  inline const std::vector<uint8_t> &log_data() const { return log_data_; }
+  inline const std::vector<uint16_t> &pwm_outputs() const { return pwm_outputs_; }
+  inline void set_log_capacity(size_t capacity) { log_capacity_ = capacity; }
+  inline std::vector<uint8_t> &memory() { return memory_; }
+  inline uint32_t memory_erase_count() const { return memory_erase_count_; }
 
 };
 